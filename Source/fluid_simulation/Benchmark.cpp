@@ -0,0 +1,368 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "ParticleManager.h"
+#include "ProcessStats.h"
+#include "Scene.h"
+
+using namespace std;
+
+namespace SPH
+{
+    namespace
+    {
+        // Comma separated list of numbers, false if one cannot be read
+        template <typename T>
+        bool parseList(const char* text, vector<T>& values)
+        {
+            values.clear();
+            stringstream stream(text);
+            string item;
+            while (getline(stream, item, ','))
+            {
+                char* end;
+                unsigned long value = strtoul(item.c_str(), &end, 10);
+                if (item.empty() || *end != '\0')
+                    return false;
+                values.push_back(static_cast<T>(value));
+            }
+            return !values.empty();
+        }
+
+        // Number after "key": on a line written by Benchmark::write, NAN when absent
+        double numberOf(const string& line, const char* key)
+        {
+            string pattern = string("\"") + key + "\":";
+            size_t at = line.find(pattern);
+            if (at == string::npos)
+                return NAN;
+            return strtod(line.c_str() + at + pattern.size(), nullptr);
+        }
+
+        string nameOf(const string& line)
+        {
+            const string pattern = "\"name\": \"";
+            size_t at = line.find(pattern);
+            if (at == string::npos)
+                return {};
+            at += pattern.size();
+            return line.substr(at, line.find('"', at) - at);
+        }
+
+        // One case per line, by name
+        bool readResults(const string& fileName, vector<pair<string, string>>& cases)
+        {
+            ifstream file(fileName);
+            if (!file)
+                return false;
+
+            string line;
+            while (getline(file, line))
+            {
+                string name = nameOf(line);
+                if (!name.empty())
+                    cases.push_back({ name, line });
+            }
+            return true;
+        }
+    }
+
+    bool BenchmarkOptions::parse(int argc, char** argv)
+    {
+        for (int i{ 1 }; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (strcmp(arg, "--bench") == 0)
+                continue;
+            if (!value)
+                return false;
+
+            if (strcmp(arg, "--particles") == 0)
+            {
+                if (!parseList(value, counts))
+                    return false;
+            }
+            else if (strcmp(arg, "--threads") == 0)
+            {
+                if (!parseList(value, threads) || std::count(threads.begin(), threads.end(), 0u) > 0)
+                    return false;
+            }
+            else if (strcmp(arg, "--configs") == 0)
+            {
+                configs.clear();
+                stringstream stream(value);
+                string name;
+                while (getline(stream, name, ','))
+                {
+                    const vector<string>& known = Benchmark::configNames();
+                    if (std::find(known.begin(), known.end(), name) == known.end())
+                        return false;
+                    configs.push_back(name);
+                }
+            }
+            else if (strcmp(arg, "--steps") == 0)
+                steps = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--output") == 0)
+                output = value;
+            else
+                return false;
+
+            ++i;
+        }
+
+        return true;
+    }
+
+    Benchmark::Benchmark(const BenchmarkOptions& options)
+        : _options(options)
+    {
+        if (_options.threads.empty())
+        {
+            _options.threads.push_back(1);
+            uint hardware = std::thread::hardware_concurrency();
+            if (hardware > 1)
+                _options.threads.push_back(hardware);
+        }
+
+        if (_options.configs.empty())
+            _options.configs = configNames();
+
+        // The peak memory of the process only grows, the small cases go first so each one reads its own
+        std::sort(_options.counts.begin(), _options.counts.end());
+    }
+
+    const vector<string>& Benchmark::configNames()
+    {
+        static const vector<string> names = { "default", "radix", "leapfrog", "stabilised", "tension", "boundary", "sleeping" };
+        return names;
+    }
+
+    void Benchmark::configure(ParticleManager& particleManager, const string& config)
+    {
+        if (config == "radix")
+            particleManager.setGridBackend(GridBackend::ParallelRadix);
+        else if (config == "leapfrog")
+            particleManager.setIntegrator(Integrator::Leapfrog);
+        else if (config == "stabilised")
+        {
+            particleManager.setXsph(ParticleManager::XSPH_EPSILON);
+            particleManager.setArtificialViscosity(ParticleManager::ARTIFICIAL_ALPHA);
+        }
+        else if (config == "tension")
+            particleManager.setSurfaceTension(true);
+        else if (config == "boundary")
+            particleManager.setBoundaryParticles(true);
+        else if (config == "sleeping")
+            particleManager.setSleeping(true);
+    }
+
+    Scene Benchmark::startScene(ulong count)
+    {
+        Scene scene;
+        scene.seed = SEED;
+
+        // Square lattice a little smaller than the screen, so the rows fit whatever the count
+        double spacing = std::min(MAX_SPACING, sqrt(SCREEN_WIDTH * SCREEN_HEIGHT / static_cast<double>(count)) * 0.98);
+        ulong columns = std::min<ulong>(static_cast<ulong>((SCREEN_WIDTH - spacing) / spacing) + 1, count);
+        ulong rows = count / columns;
+        ulong last = count % columns; // particles of the partial top row
+
+        double left = spacing / 2;
+        double bottom = SCREEN_HEIGHT - spacing / 2;
+        double right = left + (columns - 1) * spacing;
+        double top = bottom - (rows - 1) * spacing;
+        scene.blocks.push_back({ left, top, right, bottom, spacing, 0.1, 0 });
+
+        if (last > 0)
+        {
+            double y = top - spacing;
+            scene.blocks.push_back({ left, y, left + (last - 1) * spacing, y, spacing, 0.1, 0 });
+        }
+
+        return scene;
+    }
+
+    Benchmark::Result Benchmark::runCase(ulong count, uint threads, const string& config) const
+    {
+        using Clock = chrono::steady_clock;
+
+        ParticleManager particleManager(threads);
+        Scene scene = startScene(count);
+        auto loading = Clock::now();
+        particleManager.loadScene(scene);
+        double sceneLoadMs = chrono::duration<double, milli>(Clock::now() - loading).count();
+        configure(particleManager, config);
+
+        uint steps = _options.steps;
+        if (steps == 0)
+            steps = std::clamp(static_cast<uint>(STEP_BUDGET / count), MIN_STEPS, MAX_STEPS);
+
+        for (uint s{}; s < WARMUP_STEPS; ++s)
+            particleManager.update(FRAME_TIME);
+
+        const PhaseTimers& timers = particleManager.getPhaseTimers();
+        double before[] = { timers.getTotal(Phase::Grid), timers.getTotal(Phase::Density),
+                            timers.getTotal(Phase::Forces), timers.getTotal(Phase::Integrate) };
+        uint64_t allocations = allocationCount();
+        auto start = Clock::now();
+
+        for (uint s{}; s < steps; ++s)
+            particleManager.update(FRAME_TIME);
+
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        allocations = allocationCount() - allocations;
+
+        // The particles of the last step, sinks and walls can take a few
+        ulong particles = std::max<ulong>(particleManager.getSnapshot()->size(), 1);
+        auto nsPerParticle = [&](Phase phase, double since)
+        {
+            return (timers.getTotal(phase) - since) * 1e9 / (static_cast<double>(particles) * steps);
+        };
+
+        Result result;
+        result.particles = particles;
+        result.threads = threads;
+        result.config = config;
+        result.steps = steps;
+        result.gridNs = nsPerParticle(Phase::Grid, before[0]);
+        result.densityNs = nsPerParticle(Phase::Density, before[1]);
+        result.forcesNs = nsPerParticle(Phase::Forces, before[2]);
+        result.integrateNs = nsPerParticle(Phase::Integrate, before[3]);
+        result.totalNs = seconds * 1e9 / (static_cast<double>(particles) * steps);
+        result.sceneLoadMs = sceneLoadMs;
+        result.stepsPerSecond = steps / seconds;
+        result.peakRssMb = peakResidentBytes() / (1024.0 * 1024.0);
+        result.allocationsPerStep = static_cast<double>(allocations) / steps;
+
+        // The requested count names the case, the lattice may have lost a few to the walls
+        stringstream name;
+        name << "n=" << count << " threads=" << threads << " " << config;
+        result.name = name.str();
+        return result;
+    }
+
+    int Benchmark::run()
+    {
+        vector<Result> results;
+
+        for (ulong count : _options.counts)
+            for (uint threads : _options.threads)
+                for (const string& config : _options.configs)
+                {
+                    if (count == 0)
+                        continue;
+
+                    Result result = runCase(count, threads, config);
+                    cout << setw(34) << left << result.name << right << fixed << setprecision(1)
+                         << setw(10) << result.stepsPerSecond << " steps/s"
+                         << setw(10) << result.totalNs << " ns/particle"
+                         << setw(10) << result.allocationsPerStep << " allocs/step" << endl;
+                    results.push_back(result);
+                }
+
+        ofstream file(_options.output);
+        if (!file)
+        {
+            cout << "cannot write " << _options.output << endl;
+            return 1;
+        }
+
+        write(file, results);
+        cout << results.size() << " cases written to " << _options.output << endl;
+        return 0;
+    }
+
+    void Benchmark::write(ostream& out, const vector<Result>& results)
+    {
+        // One case per line, compare reads them back line by line
+        out << "{\n";
+        out << "  \"version\": 2,\n";
+        out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+        out << "  \"results\": [\n";
+
+        out << setprecision(6);
+        for (size_t i{}; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"particles\": " << r.particles
+                << ", \"threads\": " << r.threads << ", \"config\": \"" << r.config << "\", \"steps\": " << r.steps
+                << ", \"grid_ns\": " << r.gridNs << ", \"density_ns\": " << r.densityNs
+                << ", \"forces_ns\": " << r.forcesNs << ", \"integrate_ns\": " << r.integrateNs
+                << ", \"total_ns\": " << r.totalNs << ", \"scene_load_ms\": " << r.sceneLoadMs
+                << ", \"steps_per_second\": " << r.stepsPerSecond << ", \"allocations_per_step\": " << r.allocationsPerStep
+                << ", \"cumulative_peak_rss_mb\": " << r.peakRssMb
+                << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        out << "  ]\n";
+        out << "}\n";
+    }
+
+    int Benchmark::compare(const string& baseline, const string& current, double threshold)
+    {
+        struct Metric
+        {
+            const char* key;
+            bool higherIsWorse;
+        };
+        // Not the peak memory, which grows with the cases run before
+        static const Metric metrics[] = {
+            { "steps_per_second", false }, { "total_ns", true }, { "grid_ns", true }, { "density_ns", true },
+            { "forces_ns", true }, { "integrate_ns", true }, { "scene_load_ms", true }, { "allocations_per_step", true }
+        };
+
+        vector<pair<string, string>> before, after;
+        if (!readResults(baseline, before) || !readResults(current, after))
+        {
+            cout << "cannot read " << (before.empty() ? baseline : current) << endl;
+            return 1;
+        }
+
+        uint regressions = 0, compared = 0;
+        cout << fixed << setprecision(2);
+
+        for (const auto& [name, line] : after)
+        {
+            auto old = std::find_if(before.begin(), before.end(), [&](const auto& c) { return c.first == name; });
+            if (old == before.end())
+            {
+                cout << name << ": not in the baseline" << endl;
+                continue;
+            }
+            ++compared;
+
+            for (const Metric& metric : metrics)
+            {
+                double was = numberOf(old->second, metric.key);
+                double is = numberOf(line, metric.key);
+                if (std::isnan(was) || std::isnan(is) || was == is)
+                    continue;
+
+                // In percent, a baseline at 0 changes infinitely
+                double change = was != 0 ? (is - was) / fabs(was) * 100 : INFINITY;
+                if (fabs(change) <= threshold)
+                    continue;
+
+                bool worse = metric.higherIsWorse == (is > was);
+                regressions += worse;
+                cout << setw(34) << left << name << setw(22) << metric.key << right
+                     << was << " -> " << is << " (" << showpos << change << noshowpos << "%) "
+                     << (worse ? "REGRESSION" : "improvement") << endl;
+            }
+        }
+
+        cout << compared << " cases compared, " << regressions << " regressions beyond " << threshold << "%" << endl;
+        return regressions > 0 ? 1 : 0;
+    }
+}
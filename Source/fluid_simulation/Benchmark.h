@@ -0,0 +1,87 @@
+#pragma once
+
+// Performance of the 2D solver over particle counts, thread counts and solver options,
+// written as JSON so two runs can be compared and the regressions found.
+//
+//   fluid_simulation --bench [--particles 200,2000,...] [--threads 1,8] [--configs default,leapfrog,...]
+//                    [--steps n] [--output benchmark.json]
+//   fluid_simulation --compare baseline.json current.json [--threshold 10]
+//
+// Each case starts from the same lattice, runs WARMUP_STEPS untimed steps, then its timed steps.
+// A result holds the time to load the scene, the time of each phase of update per particle and step,
+// the steps per second and the allocations per step. The peak resident memory of the process
+// is the highest of every case run so far, compare leaves it out.
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    class ParticleManager;
+    struct Scene;
+
+    struct BenchmarkOptions
+    {
+        // The presets of GameSPH, then beyond what the window runs
+        std::vector<ulong> counts = { 1, 200, 400, 700, 900, 1500, 2000, 3000, 5000, 10000, 100000, 1000000 };
+        std::vector<uint> threads;            // 1 and every hardware thread when empty
+        std::vector<std::string> configs;     // all of Benchmark::configNames when empty
+        uint steps = 0;                       // 0 for about STEP_BUDGET particle steps per case
+        std::string output = "benchmark.json";
+
+        // false on an unknown option, configuration or incomplete option
+        bool parse(int argc, char** argv);
+    };
+
+    class Benchmark
+    {
+        using cdouble = const double;
+        using cuint = const uint;
+
+        inline static const float FRAME_TIME = 1.0f / 30; // as GameSPH at its target FPS
+        inline static cdouble STEP_BUDGET = 2e6;
+        inline static cuint MIN_STEPS = 3;
+        inline static cuint MAX_STEPS = 200;
+        inline static cuint WARMUP_STEPS = 2;
+        inline static cdouble MAX_SPACING = 4.0; // of the starting lattice, closer when the screen is too small for it
+        inline static cuint SEED = 1;
+
+    public:
+        struct Result
+        {
+            std::string name;
+            ulong particles;
+            uint threads;
+            std::string config;
+            uint steps;
+            double gridNs, densityNs, forcesNs, integrateNs, totalNs; // per particle and step
+            double sceneLoadMs;
+            double stepsPerSecond;
+            double peakRssMb; // of the process since it started, not of this case only
+            double allocationsPerStep;
+        };
+
+        explicit Benchmark(const BenchmarkOptions&);
+
+        // Runs every case and writes the results, returns the exit code of the program
+        int run();
+
+        // Compares two files written by run. Prints the changes beyond threshold percent,
+        // returns 1 when one of them is a regression or a file cannot be read
+        static int compare(const std::string& baseline, const std::string& current, double threshold);
+
+        static const std::vector<std::string>& configNames();
+
+    private:
+        Result runCase(ulong count, uint threads, const std::string& config) const;
+        // count particles on a lattice filling the screen from the bottom
+        static Scene startScene(ulong count);
+        static void configure(ParticleManager&, const std::string& config);
+        static void write(std::ostream&, const std::vector<Result>&);
+
+        BenchmarkOptions _options;
+    };
+}
@@ -0,0 +1,126 @@
+#include "BoundaryParticles.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Kernels.h"
+#include "SdfField.h"
+
+namespace SPH
+{
+    BoundaryParticles::BoundaryParticles()
+        : _cellStart(Shape::NB_CELLS)
+        , _cellEnd(Shape::NB_CELLS)
+    {}
+
+    std::size_t BoundaryParticles::size() const
+    {
+        return _samples.size();
+    }
+
+    uint BoundaryParticles::cellOf(double x, double y)
+    {
+        int cellX = std::clamp(static_cast<int>(floor(x / Shape::CEll_SIZE)), 0, Shape::ROW_SIZE - 1);
+        int cellY = std::clamp(static_cast<int>(floor(y / Shape::CEll_SIZE)), 0, Shape::COL_SIZE - 1);
+        return Shape::cellId(cellX, cellY);
+    }
+
+    void BoundaryParticles::build(const SdfField& obstacles)
+    {
+        _samples.clear();
+
+        sampleWalls();
+        if (!obstacles.isEmpty())
+            sampleObstacles(obstacles);
+
+        sortByCell();
+        computeVolumes();
+    }
+
+    void BoundaryParticles::sampleWalls()
+    {
+        for (double x{}; x <= SCREEN_WIDTH; x += SPACING)
+        {
+            _samples.push_back({ x, 0, 0 });
+            _samples.push_back({ x, SCREEN_HEIGHT, 0 });
+        }
+
+        for (double y{ SPACING }; y < SCREEN_HEIGHT; y += SPACING)
+        {
+            _samples.push_back({ 0, y, 0 });
+            _samples.push_back({ SCREEN_WIDTH, y, 0 });
+        }
+    }
+
+    void BoundaryParticles::sampleObstacles(const SdfField& obstacles)
+    {
+        // Lattice points close to the surface, moved onto it along the gradient
+        for (double y{ SPACING }; y < SCREEN_HEIGHT; y += SPACING)
+            for (double x{ SPACING }; x < SCREEN_WIDTH; x += SPACING)
+            {
+                double gx, gy;
+                double dist = obstacles.sample(x, y, gx, gy);
+                double norm = sqrt(gx * gx + gy * gy);
+
+                if (fabs(dist) < SPACING * 0.5 && norm > 0)
+                    _samples.push_back({ x - dist * gx / norm, y - dist * gy / norm, 0 });
+            }
+    }
+
+    void BoundaryParticles::sortByCell()
+    {
+        std::stable_sort(_samples.begin(), _samples.end(), [](const Sample& a, const Sample& b)
+        {
+            return cellOf(a.x, a.y) < cellOf(b.x, b.y);
+        });
+
+        std::fill(_cellStart.begin(), _cellStart.end(), 0);
+        std::fill(_cellEnd.begin(), _cellEnd.end(), 0);
+
+        for (uint i{}; i < _samples.size(); ++i)
+        {
+            uint id = cellOf(_samples[i].x, _samples[i].y);
+            if (_cellEnd[id] == 0)
+                _cellStart[id] = i;
+            _cellEnd[id] = i + 1;
+        }
+    }
+
+    void BoundaryParticles::computeVolumes()
+    {
+        // The samples are not evenly spaced where surfaces bend or meet,
+        // each one stands for the part of the surface it does not share with its neighbours
+        cdouble hsq = H * H;
+        cdouble poly6 = Kernels<2>::poly6(H);
+
+        for (Sample& s : _samples)
+        {
+            uint id = cellOf(s.x, s.y);
+            double sum = 0;
+
+            Shape::forEachNeighbourCell(id % Shape::ROW_SIZE, id / Shape::ROW_SIZE, [&](uint near)
+            {
+                for (const Sample& other : cell(near))
+                {
+                    double tmpX = other.x - s.x;
+                    double tmpY = other.y - s.y;
+                    double distanceSqrt = tmpX * tmpX + tmpY * tmpY;
+
+                    if (distanceSqrt < hsq)
+                    {
+                        double tmpProcess = hsq - distanceSqrt;
+                        sum += poly6 * tmpProcess * tmpProcess * tmpProcess;
+                    }
+                }
+            });
+
+            s.volume = 1.0 / sum;
+        }
+    }
+
+    void BoundaryParticles::render() const
+    {
+        for (const Sample& s : _samples)
+            DrawPixel(static_cast<int>(s.x), static_cast<int>(s.y), sampleColor);
+    }
+}
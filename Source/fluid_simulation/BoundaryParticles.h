@@ -0,0 +1,73 @@
+#pragma once
+
+// Static particles sampling the solid boundaries (Akinci et al. 2012,
+// "Versatile rigid-fluid coupling for incompressible SPH").
+// They never move, so they are sorted by cell once when the boundaries change
+// and a neighbour search reads them straight from their cell.
+
+#include <cstddef>
+#include <vector>
+#include <raylib.h>
+
+#include "Globals.h"
+#include "SpatialGrid.h"
+
+namespace SPH
+{
+    class SdfField;
+
+    class BoundaryParticles
+    {
+        using cdouble = const double;
+        using Shape = SpatialGrid::Shape;
+
+        inline static cdouble H = Shape::CEll_SIZE; // kernel radius
+        inline static cdouble SPACING = H / 8.0;   // between two samples of a surface
+
+        const Color sampleColor{ 40, 40, 40, 255 };
+
+    public:
+        struct Sample
+        {
+            double x, y;
+            double volume; // 1 / sum of the kernel over the neighbouring samples
+        };
+
+        // Samples of one cell, usable in a range-for
+        struct Range
+        {
+            const Sample* first;
+            const Sample* last;
+
+            const Sample* begin() const { return first; }
+            const Sample* end() const { return last; }
+        };
+
+        BoundaryParticles();
+
+        // Samples the four walls of the screen and the surface of the obstacles
+        void build(const SdfField& obstacles);
+
+        Range cell(uint id) const
+        {
+            return { _samples.data() + _cellStart[id], _samples.data() + _cellEnd[id] };
+        }
+
+        std::size_t size() const;
+
+        void render() const;
+
+    private:
+        // Samples on a wall belong to the closest cell inside the screen
+        static uint cellOf(double x, double y);
+
+        void sampleWalls();
+        void sampleObstacles(const SdfField& obstacles);
+        void sortByCell();
+        void computeVolumes();
+
+        std::vector<Sample> _samples; // sorted by cell
+        std::vector<uint> _cellStart;
+        std::vector<uint> _cellEnd;
+    };
+}
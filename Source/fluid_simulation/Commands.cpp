@@ -11,33 +11,63 @@ namespace SPH
     CmdAddOne::CmdAddOne(ParticleManager& pm, int x, int y)
         : ICommand{pm}
         , _x{x}, _y{y}
+        , _first{}, _last{}
     {
     }
 
     void CmdAddOne::execute()
     {
+        _first = _pm.getNextId();
         _pm.addOne(_x,_y);
+        _last = _pm.getNextId();
     }
 
     void CmdAddOne::undo()
     {
-        _pm.removeParticles(1);
+        _pm.removeSpawned(_first, _last);
     }
 
     CmdAddGroup::CmdAddGroup(ParticleManager& pm, int x, int y)
         : ICommand{pm}
         , _x{ x }, _y{ y }
-        , _nbParticles{}
+        , _first{}, _last{}
     {}
 
     void CmdAddGroup::execute()
     {
-        _nbParticles = _pm.addBlock(_x, _y);
+        _first = _pm.getNextId();
+        _pm.addBlock(_x, _y);
+        _last = _pm.getNextId();
     }
 
     void CmdAddGroup::undo()
     {
-        _pm.removeParticles(_nbParticles);
+        _pm.removeSpawned(_first, _last);
+    }
+
+    CmdBrush::CmdBrush(ParticleManager& pm, float strength)
+        : ICommand{ pm }
+        , _strength{ strength }
+        , _touched{ std::make_shared<BrushRecord>() }
+    {}
+
+    void CmdBrush::addSample(int x, int y)
+    {
+        _path.push_back({ static_cast<short>(x), static_cast<short>(y) });
+        _pm.addBrushStroke(x, y, _strength, _touched);
+    }
+
+    void CmdBrush::execute()
+    {
+        // Replayed one sample per update by the particle manager
+        _touched = std::make_shared<BrushRecord>();
+        for (const Sample& s : _path)
+            _pm.addBrushStroke(s.x, s.y, _strength, _touched);
+    }
+
+    void CmdBrush::undo()
+    {
+        _pm.undoBrush(_touched);
     }
 
     CmdChangeColor::CmdChangeColor(ParticleManager& pm, const Color& old)
@@ -1,10 +1,13 @@
 #pragma once
+#include <memory>
+#include <vector>
 #include "Globals.h"
 
 struct Color;
 namespace SPH
 {
     class ParticleManager;
+    struct BrushRecord;
     class ICommand
     {
     protected: 
@@ -18,9 +21,11 @@ namespace SPH
     
     };
 
+    // The added particles are found by their ids to be undone, emitters and sinks may have moved them
     class CmdAddOne : public ICommand
     {
         int _x, _y;
+        uint _first, _last;
     public:
         CmdAddOne(ParticleManager&, int, int);
         void execute() override;
@@ -30,13 +35,33 @@ namespace SPH
     class CmdAddGroup : public ICommand
     {
         int _x, _y;
-        int _nbParticles;
+        uint _first, _last;
     public:
         CmdAddGroup(ParticleManager&, int, int);
         void execute() override;
         void undo() override;
     };
 
+    // One drag of a push or attract brush, the cursor positions of each frame are kept
+    // to replay it. Undone by taking back from the particles it touched the velocity it gave them
+    class CmdBrush : public ICommand
+    {
+        struct Sample
+        {
+            short x, y;
+        };
+
+        float _strength;
+        std::vector<Sample> _path;
+        std::shared_ptr<BrushRecord> _touched; // of the last run
+
+    public:
+        CmdBrush(ParticleManager&, float);
+        void addSample(int, int); // applies the brush there too
+        void execute() override;
+        void undo() override;
+    };
+
     class CmdChangeColor : public ICommand
     {
         uchar _r, _g, _b;
@@ -0,0 +1,121 @@
+#include "DensityField.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FluidSnapshot.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+
+namespace SPH
+{
+    namespace
+    {
+        // Transparent where there is no fluid, then blue to red as the density grows
+        const char* colormapShader = R"(
+#version 330
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+uniform float scale;
+
+out vec4 finalColor;
+
+void main()
+{
+    float v = clamp(texture(texture0, fragTexCoord).r / scale, 0.0, 1.0);
+
+    vec3 c = mix(vec3(0.10, 0.20, 0.80), vec3(0.10, 0.75, 0.90), smoothstep(0.00, 0.35, v));
+    c = mix(c, vec3(0.95, 0.85, 0.20), smoothstep(0.35, 0.70, v));
+    c = mix(c, vec3(0.85, 0.15, 0.10), smoothstep(0.70, 1.00, v));
+
+    finalColor = vec4(c, smoothstep(0.0, 0.05, v)) * colDiffuse * fragColor;
+}
+)";
+    }
+
+    DensityField::DensityField()
+        : _values(WIDTH * HEIGHT)
+        , _changed(true)
+        , _texture{}
+        , _shader{}
+        , _scaleLoc(-1)
+    {}
+
+    DensityField::~DensityField()
+    {
+        // Past CloseWindow the context is gone, and with it what was loaded
+        if (_texture.id == 0 || !IsWindowReady())
+            return;
+
+        UnloadTexture(_texture);
+        UnloadShader(_shader);
+    }
+
+    void DensityField::update(const FluidSnapshot& snapshot, ThreadPool& workers)
+    {
+        cdouble poly6 = Kernels<2>::poly6(H);
+
+        // A worker adds the particles within H of its rows to these rows only
+        workers.parallelFor(HEIGHT, [&](uint begin, uint end, uint)
+        {
+            std::fill(_values.begin() + begin * WIDTH, _values.begin() + end * WIDTH, 0.0f);
+
+            double top = begin * TEXEL_SIZE;
+            double bottom = end * TEXEL_SIZE;
+            snapshot.forEachInRect(-H, top - H, SCREEN_WIDTH + H, bottom + H, [&](const FluidSnapshot::Sample& s)
+            {
+                // The texels whose center is within H of the particle
+                int i0 = std::max(static_cast<int>(ceil((s.x - H) / TEXEL_SIZE - 0.5)), 0);
+                int i1 = std::min(static_cast<int>(floor((s.x + H) / TEXEL_SIZE - 0.5)), WIDTH - 1);
+                int j0 = std::max(static_cast<int>(ceil((s.y - H) / TEXEL_SIZE - 0.5)), static_cast<int>(begin));
+                int j1 = std::min(static_cast<int>(floor((s.y + H) / TEXEL_SIZE - 0.5)), static_cast<int>(end) - 1);
+
+                for (int j{ j0 }; j <= j1; ++j)
+                {
+                    double tmpY = (j + 0.5) * TEXEL_SIZE - s.y;
+                    for (int i{ i0 }; i <= i1; ++i)
+                    {
+                        double tmpX = (i + 0.5) * TEXEL_SIZE - s.x;
+                        double distanceSqrt = tmpX * tmpX + tmpY * tmpY;
+
+                        if (distanceSqrt < HSQ)
+                        {
+                            double tmpProcess = HSQ - distanceSqrt;
+                            _values[i + j * WIDTH] += static_cast<float>(s.mass * poly6 * tmpProcess * tmpProcess * tmpProcess);
+                        }
+                    }
+                }
+            });
+        });
+
+        _changed = true;
+    }
+
+    void DensityField::render(float scale)
+    {
+        if (_texture.id == 0)
+        {
+            Image image{ _values.data(), WIDTH, HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R32 };
+            _texture = LoadTextureFromImage(image);
+            SetTextureFilter(_texture, TEXTURE_FILTER_BILINEAR);
+
+            _shader = LoadShaderFromMemory(nullptr, colormapShader);
+            _scaleLoc = GetShaderLocation(_shader, "scale");
+        }
+        else if (_changed)
+            UpdateTexture(_texture, _values.data());
+        _changed = false;
+
+        SetShaderValue(_shader, _scaleLoc, &scale, SHADER_UNIFORM_FLOAT);
+
+        BeginShaderMode(_shader);
+        Rectangle source{ 0, 0, (float)WIDTH, (float)HEIGHT };
+        Rectangle dest{ 0, 0, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT };
+        DrawTexturePro(_texture, source, dest, Vector2{}, 0, WHITE);
+        EndShaderMode();
+    }
+}
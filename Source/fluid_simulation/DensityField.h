@@ -0,0 +1,51 @@
+#pragma once
+
+// Density of the fluid sampled on a coarse grid over the screen, uploaded as one float
+// texture and drawn through a colormap shader: one draw call whatever the particle count.
+// Each particle adds its kernel to the texels around it, once per new snapshot.
+
+#include <vector>
+#include <raylib.h>
+
+#include "Globals.h"
+#include "SpatialGrid.h"
+
+namespace SPH
+{
+    class FluidSnapshot;
+    class ThreadPool;
+
+    class DensityField
+    {
+        using cint = const int;
+        using cdouble = const double;
+
+        inline static cint TEXEL_SIZE = 4; // pixels covered by one texel
+        inline static cint WIDTH = SCREEN_WIDTH / TEXEL_SIZE;
+        inline static cint HEIGHT = SCREEN_HEIGHT / TEXEL_SIZE;
+        inline static cdouble H = SpatialGrid::Shape::CEll_SIZE; // kernel radius, as the simulation
+        inline static cdouble HSQ = H * H;
+
+    public:
+        DensityField();
+        ~DensityField();
+
+        DensityField(const DensityField&) = delete;
+        DensityField& operator=(const DensityField&) = delete;
+
+        // Density at the center of each texel, rows split between the workers
+        void update(const FluidSnapshot&, ThreadPool&);
+
+        // scale is the density drawn with the last color of the map
+        void render(float scale);
+
+    private:
+        std::vector<float> _values;
+        bool _changed; // since the last upload
+
+        // Created by the first render, the window must exist
+        Texture2D _texture;
+        Shader _shader;
+        int _scaleLoc;
+    };
+}
@@ -0,0 +1,256 @@
+#include "DistributedRun.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "DomainRank.h"
+#include "LocalTransport.h"
+#include "Scene.h"
+#include "SocketTransport.h"
+
+using namespace std;
+
+namespace SPH
+{
+    bool DistributedOptions::parse(int argc, char** argv)
+    {
+        for (int i{ 1 }; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (strcmp(arg, "--verify") == 0)
+            {
+                verify = true;
+                continue;
+            }
+            if (!value)
+                return false;
+
+            if (strcmp(arg, "--ranks") == 0)
+                ranks = static_cast<uint>(strtoul(value, nullptr, 10));
+#ifndef _WIN32
+            else if (strcmp(arg, "--transport") == 0 && strcmp(value, "sockets") == 0)
+                transport = value;
+#endif
+            else if (strcmp(arg, "--transport") == 0 && strcmp(value, "threads") == 0)
+                transport = value;
+            else if (strcmp(arg, "--scene") == 0)
+                scene = value;
+            else if (strcmp(arg, "--frames") == 0)
+                frames = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--workers") == 0)
+                workers = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--balance") == 0)
+                balance = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--flip") == 0)
+                flip = static_cast<uint>(strtoul(value, nullptr, 10));
+            else
+                return false;
+
+            ++i;
+        }
+
+        // A rank owns a column of cells at least
+        return ranks >= 1 && ranks <= static_cast<uint>(SpatialGrid::Shape::ROW_SIZE) && workers >= 1;
+    }
+
+    DistributedRun::DistributedRun(const DistributedOptions& options)
+        : _options(options)
+    {}
+
+    int DistributedRun::run()
+    {
+        Scene scene;
+        if (_options.scene.empty())
+        {
+            // Column of fluid against the left wall, as the dam break of the physics checks
+            scene.seed = 1;
+            scene.blocks.push_back({ 10, 230, 200, 470, 5, 0.2, 0 });
+        }
+        else
+        {
+            string error;
+            if (!scene.load(_options.scene, error))
+            {
+                cout << "cannot load " << _options.scene << ", " << error << endl;
+                return 1;
+            }
+        }
+
+        // Particles coming in or going out would need an owner for the emitters and the sinks
+        if (!scene.emitters.empty() || !scene.sinks.empty() || scene.sleeping.value_or(false))
+        {
+            cout << "a distributed run needs a closed scene, without emitters, sinks or sleeping cells" << endl;
+            return 1;
+        }
+
+        uint ranks = _options.ranks;
+        cout << ranks << " ranks over " << _options.transport << endl;
+
+        if (_options.transport == "threads")
+        {
+            LocalTransport::Hub hub(ranks);
+            vector<int> codes(ranks);
+            vector<thread> threads;
+
+            for (uint r{ 1 }; r < ranks; ++r)
+                threads.emplace_back([&, r]
+                {
+                    LocalTransport transport(hub, r);
+                    codes[r] = runRank(transport, scene);
+                });
+
+            LocalTransport transport(hub, 0);
+            codes[0] = runRank(transport, scene);
+
+            for (thread& t : threads)
+                t.join();
+            return *max_element(codes.begin(), codes.end());
+        }
+
+#ifndef _WIN32
+        SocketTransport::Sockets sockets;
+        if (!SocketTransport::connectAll(ranks, sockets))
+        {
+            cout << "cannot create the sockets between the ranks" << endl;
+            return 1;
+        }
+
+        // What is buffered would be written again by every process
+        cout.flush();
+
+        vector<pid_t> children;
+        for (uint r{ 1 }; r < ranks; ++r)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                int code;
+                {
+                    SocketTransport transport(sockets, r);
+                    code = runRank(transport, scene);
+                }
+                cout.flush();
+                _exit(code);
+            }
+            if (pid < 0)
+            {
+                cout << "cannot start rank " << r << endl;
+                return 1;
+            }
+            children.push_back(pid);
+        }
+
+        int code;
+        {
+            SocketTransport transport(sockets, 0);
+            code = runRank(transport, scene);
+        }
+
+        for (pid_t child : children)
+        {
+            int status = 0;
+            waitpid(child, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                code = 1;
+        }
+        return code;
+#else
+        return 1;
+#endif
+    }
+
+    int DistributedRun::runRank(Transport& transport, const Scene& scene) const
+    {
+        using Clock = chrono::steady_clock;
+
+        DomainRank domain(transport, scene, DomainRank::slabs(transport.size()), _options.workers);
+
+        double ghosts = 0, migrated = 0;
+        auto start = Clock::now();
+
+        for (uint frame{}; frame < _options.frames; ++frame)
+        {
+            if (_options.flip > 0 && frame > 0 && frame % _options.flip == 0)
+                domain.setGravity(gravityAt(frame));
+
+            if (_options.balance > 0 && frame > 0 && frame % _options.balance == 0)
+            {
+                DomainRank::Rebalance balance = domain.rebalance();
+                if (transport.rank() == 0)
+                    cout << "frame " << frame << ": imbalance " << balance.before << " -> " << balance.after << ", "
+                         << balance.particles << " particles (" << balance.bytes / 1024 << " KB) moved in "
+                         << balance.seconds * 1000 << " ms" << endl;
+            }
+
+            domain.step(FRAME_TIME);
+            ghosts += domain.ghostCount();
+            migrated += domain.migratedCount();
+        }
+
+        // Per frame, for the report of rank 0
+        double frames = max(_options.frames, 1u);
+        double stats[] = { static_cast<double>(domain.ownedCount()), ghosts / frames, migrated / frames,
+                           chrono::duration<double>(Clock::now() - start).count() * 1000 / frames };
+
+        if (transport.rank() != 0)
+        {
+            Transport::Bytes bytes(sizeof(stats));
+            memcpy(bytes.data(), stats, sizeof(stats));
+            transport.send(0, bytes);
+            domain.gather();
+            return 0;
+        }
+
+        for (uint r{}; r < transport.size(); ++r)
+        {
+            if (r > 0)
+                memcpy(stats, transport.receive(r).data(), sizeof(stats));
+
+            cout << "rank " << r << ": " << stats[0] << " particles at the end, " << stats[1] << " ghosts and "
+                 << stats[2] << " arrivals per frame, " << stats[3] << " ms/frame" << endl;
+        }
+
+        vector<Particle> particles = domain.gather();
+        cout << particles.size() << " particles after " << _options.frames << " frames" << endl;
+
+        return _options.verify ? verify(scene, particles) : 0;
+    }
+
+    int DistributedRun::gravityAt(uint frame) const
+    {
+        static const int turns[] = { DOWN, RIGHT, UP, LEFT };
+        return turns[(frame / _options.flip) % 4];
+    }
+
+    int DistributedRun::verify(const Scene& scene, const vector<Particle>& particles) const
+    {
+        ParticleManager reference(_options.workers);
+        reference.loadScene(scene);
+        for (uint frame{}; frame < _options.frames; ++frame)
+        {
+            if (_options.flip > 0 && frame > 0 && frame % _options.flip == 0)
+                reference.setGravity(gravityAt(frame));
+            reference.update(FRAME_TIME);
+        }
+
+        const vector<Particle>& expected = reference.getParticles();
+        double largest = expected.size() == particles.size() ? 0 : INFINITY;
+        for (size_t i{}; i < particles.size() && i < expected.size(); ++i)
+            largest = max(largest, hypot(particles[i].x - expected[i].x, particles[i].y - expected[i].y));
+
+        bool same = largest <= VERIFY_TOLERANCE;
+        cout << "largest distance from the single process run: " << largest << " px" << (same ? "" : ", too far") << endl;
+        return same ? 0 : 1;
+    }
+}
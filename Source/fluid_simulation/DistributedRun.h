@@ -0,0 +1,66 @@
+#pragma once
+
+// The 2D simulation split between several ranks, each one simulating the particles of its
+// own part of the grid, see DomainRank.h. Without a window, as a headless run.
+//
+//   fluid_simulation --ranks 4 [--transport sockets|threads] [--scene file] [--frames 300]
+//                    [--workers 1] [--balance 30] [--flip 0] [--verify]
+//
+// With sockets the ranks are processes of this machine connected by Unix domain sockets,
+// with threads they run in this process. Rank 0 gathers the particles at the end and with
+// --verify compares them with the same frames run by one process.
+// The ranks start with slabs of columns and every --balance frames share the grid again
+// along a Hilbert curve, --flip turns gravity by a quarter every few frames to move the load.
+// The scenes must be closed: no emitters, sinks or sleeping cells.
+
+#include <string>
+#include <vector>
+
+#include "Globals.h"
+#include "Particle.h"
+
+namespace SPH
+{
+    class Transport;
+    struct Scene;
+
+    struct DistributedOptions
+    {
+        uint ranks = 2;
+#ifdef _WIN32
+        std::string transport = "threads";
+#else
+        std::string transport = "sockets";
+#endif
+        std::string scene;  // a dam break when empty
+        uint frames = 300;
+        uint workers = 1;   // threads of each rank
+        uint balance = 30;  // frames between two rebalances, 0 keeps the slabs
+        uint flip = 0;      // frames between two turns of gravity, 0 for none
+        bool verify = false;
+
+        // false on an unknown or incomplete option
+        bool parse(int argc, char** argv);
+    };
+
+    class DistributedRun
+    {
+        inline static const float FRAME_TIME = 1.0f / 30; // as GameSPH at its target FPS
+        inline static const double VERIFY_TOLERANCE = 1e-9; // px
+
+    public:
+        explicit DistributedRun(const DistributedOptions&);
+
+        // Returns the exit code of the program
+        int run();
+
+    private:
+        // Runs one rank to the end, rank 0 reports
+        int runRank(Transport&, const Scene&) const;
+        int verify(const Scene&, const std::vector<Particle>&) const;
+        // Direction of gravity at the frame
+        int gravityAt(uint frame) const;
+
+        DistributedOptions _options;
+    };
+}
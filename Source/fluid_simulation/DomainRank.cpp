@@ -0,0 +1,326 @@
+#include "DomainRank.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+
+#include "HilbertCurve.h"
+
+namespace SPH
+{
+    DomainRank::Owners DomainRank::slabs(uint ranks)
+    {
+        Owners owners(Shape::NB_CELLS);
+        for (uint y{}; y < Shape::COL_SIZE; ++y)
+            for (uint x{}; x < Shape::ROW_SIZE; ++x)
+                owners[Shape::cellId(x, y)] = x * ranks / Shape::ROW_SIZE;
+        return owners;
+    }
+
+    DomainRank::Owners DomainRank::curvePieces(const Costs& costs, uint ranks)
+    {
+        std::vector<uint> cells(Shape::NB_CELLS);
+        std::vector<uint> position(Shape::NB_CELLS);
+        for (uint id{}; id < cells.size(); ++id)
+        {
+            cells[id] = id;
+            position[id] = hilbertIndex(CURVE_ORDER, id % Shape::ROW_SIZE, id / Shape::ROW_SIZE);
+        }
+        std::sort(cells.begin(), cells.end(), [&](uint a, uint b) { return position[a] < position[b]; });
+
+        // A cell goes to the rank its middle falls in, along the cost summed over the curve.
+        // Without any cost the cells are shared out by number.
+        uint64_t total = std::accumulate(costs.begin(), costs.end(), uint64_t{});
+        Owners owners(Shape::NB_CELLS);
+        uint64_t before = 0;
+
+        for (uint k{}; k < cells.size(); ++k)
+        {
+            uint id = cells[k];
+            double middle = total > 0 ? (before + costs[id] * 0.5) / total : (k + 0.5) / cells.size();
+            owners[id] = std::min(static_cast<uint>(middle * ranks), ranks - 1);
+            before += costs[id];
+        }
+
+        return owners;
+    }
+
+    double DomainRank::imbalance(const Owners& owners, const Costs& costs, uint ranks)
+    {
+        std::vector<uint64_t> load(ranks);
+        for (uint id{}; id < costs.size(); ++id)
+            load[owners[id]] += costs[id];
+
+        uint64_t total = std::accumulate(load.begin(), load.end(), uint64_t{});
+        if (total == 0)
+            return 1;
+        return *std::max_element(load.begin(), load.end()) * static_cast<double>(ranks) / total;
+    }
+
+    DomainRank::DomainRank(Transport& transport, const Scene& scene, const Owners& owners, uint workers)
+        : _transport(transport)
+        , _particleManager(workers)
+        , _ghosts(0)
+        , _migrated(0)
+    {
+        setOwners(owners);
+
+        _particleManager.loadScene(scene);
+        const std::vector<Particle>& particles = _particleManager.getParticles();
+        for (uint i{}; i < particles.size(); ++i)
+            if (_owners[Shape::cellOf(particles[i])] == _transport.rank())
+            {
+                _ids.push_back(i);
+                _owned.push_back(particles[i]);
+            }
+    }
+
+    void DomainRank::setOwners(const Owners& owners)
+    {
+        _owners = owners;
+        _haloRanks.assign(Shape::NB_CELLS, {});
+
+        for (int y{}; y < Shape::COL_SIZE; ++y)
+            for (int x{}; x < Shape::ROW_SIZE; ++x)
+            {
+                uint id = Shape::cellId(x, y);
+                std::vector<uint>& ranks = _haloRanks[id];
+
+                for (int nearY{ std::max(y - HALO_CELLS, 0) }; nearY <= std::min(y + HALO_CELLS, Shape::COL_SIZE - 1); ++nearY)
+                    for (int nearX{ std::max(x - HALO_CELLS, 0) }; nearX <= std::min(x + HALO_CELLS, Shape::ROW_SIZE - 1); ++nearX)
+                    {
+                        uint owner = _owners[Shape::cellId(nearX, nearY)];
+                        if (owner != _owners[id] && std::find(ranks.begin(), ranks.end(), owner) == ranks.end())
+                            ranks.push_back(owner);
+                    }
+            }
+    }
+
+    void DomainRank::step(float dt)
+    {
+        std::vector<std::vector<uint>> outgoing(_transport.size());
+
+        // Ghosts: the owned particles close to the cells of the other ranks
+        for (uint i{}; i < _owned.size(); ++i)
+            for (uint other : _haloRanks[Shape::cellOf(_owned[i])])
+                outgoing[other].push_back(i);
+
+        std::vector<uint> ids = _ids;
+        std::vector<Particle> local = _owned;
+        exchange(outgoing, ids, local);
+        _ghosts = local.size() - _owned.size();
+
+        // In the order of the scene, as the single process run has them
+        std::vector<uint> order(local.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint a, uint b) { return ids[a] < ids[b]; });
+
+        std::vector<Particle> sorted;
+        sorted.reserve(local.size());
+        for (uint k : order)
+            sorted.push_back(local[k]);
+
+        _particleManager.setParticles(std::move(sorted));
+        _particleManager.update(dt);
+
+        // The owned particles come first in local, the ghosts are dropped
+        const std::vector<Particle>& moved = _particleManager.getParticles();
+        for (uint k{}; k < order.size(); ++k)
+            if (order[k] < _owned.size())
+                _owned[order[k]] = moved[k];
+
+        _migrated = migrate();
+    }
+
+    size_t DomainRank::migrate()
+    {
+        uint rank = _transport.rank();
+        std::vector<std::vector<uint>> outgoing(_transport.size());
+
+        std::vector<uint> keptIds;
+        std::vector<Particle> kept;
+        for (uint i{}; i < _owned.size(); ++i)
+        {
+            uint owner = _owners[Shape::cellOf(_owned[i])];
+            if (owner != rank)
+                outgoing[owner].push_back(i);
+            else
+            {
+                keptIds.push_back(_ids[i]);
+                kept.push_back(_owned[i]);
+            }
+        }
+
+        std::vector<uint> arrivedIds;
+        std::vector<Particle> arrived;
+        exchange(outgoing, arrivedIds, arrived);
+
+        // Back in increasing index order
+        std::vector<uint> order(arrived.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint a, uint b) { return arrivedIds[a] < arrivedIds[b]; });
+
+        _ids.clear();
+        _owned.clear();
+        size_t k = 0;
+        for (uint a : order)
+        {
+            for (; k < keptIds.size() && keptIds[k] < arrivedIds[a]; ++k)
+            {
+                _ids.push_back(keptIds[k]);
+                _owned.push_back(kept[k]);
+            }
+            _ids.push_back(arrivedIds[a]);
+            _owned.push_back(arrived[a]);
+        }
+        for (; k < keptIds.size(); ++k)
+        {
+            _ids.push_back(keptIds[k]);
+            _owned.push_back(kept[k]);
+        }
+
+        return arrived.size();
+    }
+
+    DomainRank::Rebalance DomainRank::rebalance()
+    {
+        uint rank = _transport.rank();
+        uint ranks = _transport.size();
+
+        // The pairs and particles of the owned cells in the last step, the ghost cells are only partly known here
+        std::vector<uint64_t> mine(2 * Shape::NB_CELLS);
+        for (uint id{}; id < Shape::NB_CELLS; ++id)
+            if (_owners[id] == rank)
+                mine[id] = _particleManager.getCellPairs(id);
+        for (const Particle& p : _owned)
+            ++mine[Shape::NB_CELLS + Shape::cellOf(p)];
+
+        Transport::Bytes bytes(mine.size() * sizeof(uint64_t));
+        memcpy(bytes.data(), mine.data(), bytes.size());
+
+        Costs costs(mine.begin(), mine.begin() + Shape::NB_CELLS);
+        std::vector<uint64_t> particles(mine.begin() + Shape::NB_CELLS, mine.end());
+        for (uint peer{}; peer < ranks; ++peer)
+        {
+            if (peer == rank)
+                continue;
+
+            Transport::Bytes theirs = _transport.exchange(peer, bytes);
+            const uint64_t* values = reinterpret_cast<const uint64_t*>(theirs.data());
+            for (uint id{}; id < Shape::NB_CELLS; ++id)
+            {
+                costs[id] += values[id];
+                particles[id] += values[Shape::NB_CELLS + id];
+            }
+        }
+
+        // Every rank has the same sums and cuts the curve the same way
+        Owners owners = curvePieces(costs, ranks);
+
+        Rebalance result{};
+        result.before = imbalance(_owners, costs, ranks);
+        result.after = imbalance(owners, costs, ranks);
+        for (uint id{}; id < Shape::NB_CELLS; ++id)
+            if (owners[id] != _owners[id])
+                result.particles += particles[id];
+        result.bytes = result.particles * (sizeof(uint) + sizeof(Particle));
+
+        auto start = std::chrono::steady_clock::now();
+        setOwners(owners);
+        migrate();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        return result;
+    }
+
+    void DomainRank::setGravity(int direction)
+    {
+        _particleManager.setGravity(direction);
+    }
+
+    void DomainRank::exchange(const std::vector<std::vector<uint>>& outgoing, std::vector<uint>& ids, std::vector<Particle>& particles)
+    {
+        for (uint peer{}; peer < _transport.size(); ++peer)
+            if (peer != _transport.rank())
+                unpack(_transport.exchange(peer, pack(outgoing[peer])), ids, particles);
+    }
+
+    std::vector<Particle> DomainRank::gather()
+    {
+        std::vector<uint> indices(_owned.size());
+        std::iota(indices.begin(), indices.end(), 0);
+
+        if (_transport.rank() != 0)
+        {
+            _transport.send(0, pack(indices));
+            return {};
+        }
+
+        std::vector<uint> ids = _ids;
+        std::vector<Particle> all = _owned;
+        for (uint from{ 1 }; from < _transport.size(); ++from)
+            unpack(_transport.receive(from), ids, all);
+
+        std::vector<Particle> sorted(all.size());
+        for (uint k{}; k < all.size(); ++k)
+            sorted[ids[k]] = all[k];
+        return sorted;
+    }
+
+    Transport::Bytes DomainRank::pack(const std::vector<uint>& indices) const
+    {
+        // The count, the indices in the scene, then the particles as they are in memory:
+        // the ranks run the same program on the same machine
+        uint count = static_cast<uint>(indices.size());
+        Transport::Bytes bytes(sizeof(uint) + count * (sizeof(uint) + sizeof(Particle)));
+
+        char* at = bytes.data();
+        memcpy(at, &count, sizeof(uint));
+        at += sizeof(uint);
+
+        for (uint i : indices)
+        {
+            memcpy(at, &_ids[i], sizeof(uint));
+            at += sizeof(uint);
+        }
+        for (uint i : indices)
+        {
+            memcpy(at, &_owned[i], sizeof(Particle));
+            at += sizeof(Particle);
+        }
+
+        return bytes;
+    }
+
+    void DomainRank::unpack(const Transport::Bytes& bytes, std::vector<uint>& ids, std::vector<Particle>& particles)
+    {
+        const char* at = bytes.data();
+        uint count;
+        memcpy(&count, at, sizeof(uint));
+        at += sizeof(uint);
+
+        size_t first = ids.size();
+        ids.resize(first + count);
+        particles.resize(first + count);
+
+        memcpy(ids.data() + first, at, count * sizeof(uint));
+        at += count * sizeof(uint);
+        memcpy(particles.data() + first, at, count * sizeof(Particle));
+    }
+
+    size_t DomainRank::ownedCount() const
+    {
+        return _owned.size();
+    }
+
+    size_t DomainRank::ghostCount() const
+    {
+        return _ghosts;
+    }
+
+    size_t DomainRank::migratedCount() const
+    {
+        return _migrated;
+    }
+}
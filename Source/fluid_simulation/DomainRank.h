@@ -0,0 +1,94 @@
+#pragma once
+
+// One rank of a distributed 2D run: the particles of the grid cells it owns.
+// Every step it receives as ghosts the particles of the other ranks within HALO_CELLS
+// of its cells, runs the solver on its particles and the ghosts, keeps its own and
+// hands the ones that left its cells to their new owner.
+//
+// The ghosts reach two cells out, so the density of the ghosts next to the owned cells is
+// complete and a step needs one exchange, not a second one for the densities.
+// The particles are given to the solver in the order of the scene, so the neighbour sums
+// are done in the order of the single process run and give the same results.
+//
+// The fluid piles up where gravity points, so a fixed split soon leaves most of the work to
+// a few ranks. rebalance orders the cells along a Hilbert curve and cuts it in pieces of the
+// same cost, the neighbour pairs of each cell in the last step.
+
+#include <cstdint>
+#include <vector>
+
+#include "Globals.h"
+#include "ParticleManager.h"
+#include "Transport.h"
+
+namespace SPH
+{
+    class DomainRank
+    {
+        using cint = const int;
+        using cuint = const uint;
+        using Shape = SpatialGrid::Shape;
+
+        inline static cint HALO_CELLS = 2;
+        inline static cuint CURVE_ORDER = 6; // the curve covers 64 x 64 cells, more than the grid
+
+    public:
+        using Owners = std::vector<uint>;  // rank of each grid cell
+        using Costs = std::vector<uint64_t>; // of each grid cell
+
+        // Columns of cells split in ranks slabs of the same width
+        static Owners slabs(uint ranks);
+        // The Hilbert curve over the cells cut in ranks pieces of about the same cost
+        static Owners curvePieces(const Costs&, uint ranks);
+        // Cost of the most loaded rank over the mean cost of a rank, 1 when balanced
+        static double imbalance(const Owners&, const Costs&, uint ranks);
+
+        struct Rebalance
+        {
+            double before, after; // imbalance
+            uint64_t particles;   // moved to another rank
+            uint64_t bytes;
+            double seconds;       // of the move, as this rank saw it
+        };
+
+        // The same scene in every rank, each one keeps the particles of its cells
+        DomainRank(Transport&, const Scene&, const Owners&, uint workers);
+
+        void step(float dt);
+        // Every rank at the same step, they agree on the new owners from the costs they share
+        Rebalance rebalance();
+        // Every rank at the same step
+        void setGravity(int direction);
+
+        // The particles of every rank in the order of the scene on rank 0, nothing on the others
+        std::vector<Particle> gather();
+
+        size_t ownedCount() const;
+        // Of the last step
+        size_t ghostCount() const;
+        size_t migratedCount() const;
+
+    private:
+        void setOwners(const Owners&);
+        // The owned particles now in a cell of another rank go to it, returns how many arrived
+        size_t migrate();
+
+        // Sends to every other rank its part of the owned particles, in increasing rank order,
+        // and returns what they sent
+        void exchange(const std::vector<std::vector<uint>>& outgoing, std::vector<uint>& ids, std::vector<Particle>&);
+        Transport::Bytes pack(const std::vector<uint>& indices) const; // of the owned particles
+        static void unpack(const Transport::Bytes&, std::vector<uint>& ids, std::vector<Particle>&);
+
+        Transport& _transport;
+        ParticleManager _particleManager;
+
+        Owners _owners;
+        std::vector<std::vector<uint>> _haloRanks; // of each cell, the other ranks owning a cell within HALO_CELLS
+
+        std::vector<uint> _ids; // index in the scene of each owned particle, increasing
+        std::vector<Particle> _owned;
+
+        size_t _ghosts;
+        size_t _migrated;
+    };
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Open boundaries of the 2D simulation: emitters pour fluid in, sinks take it out
+
+namespace SPH
+{
+    // Nozzle centred on (x, y), throwing particles at (vx, vy) across its width
+    struct Emitter
+    {
+        double x, y;
+        double vx, vy;
+        double width;
+        double rate;    // particles per second
+        double pending; // fraction of a particle left over from the last frames
+    };
+
+    // Particles entering the rectangle are removed
+    struct Sink
+    {
+        double left, top, right, bottom;
+
+        bool contains(double x, double y) const
+        {
+            return x >= left && x <= right && y >= top && y <= bottom;
+        }
+    };
+}
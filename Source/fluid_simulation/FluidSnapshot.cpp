@@ -0,0 +1,176 @@
+#include "FluidSnapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "Kernels.h"
+
+namespace SPH
+{
+    FluidSnapshot::FluidSnapshot()
+        : _cellStart(Shape::NB_CELLS)
+        , _cellEnd(Shape::NB_CELLS)
+    {}
+
+    void FluidSnapshot::capture(const std::vector<Particle>& particles, const SpatialGrid& grid,
+                                const std::vector<double>& materialMass)
+    {
+        _samples.clear();
+        _samples.reserve(particles.size());
+
+        for (uint id{}; id < Shape::NB_CELLS; ++id)
+        {
+            _cellStart[id] = static_cast<uint>(_samples.size());
+            for (uint i : grid.cell(id))
+            {
+                const Particle& p = particles[i];
+                _samples.push_back({ p.x, p.y, p.vx, p.vy, materialMass[p.material] });
+            }
+            _cellEnd[id] = static_cast<uint>(_samples.size());
+        }
+    }
+
+    std::size_t FluidSnapshot::size() const
+    {
+        return _samples.size();
+    }
+
+    uint FluidSnapshot::clampCellX(double x)
+    {
+        return std::clamp(static_cast<int>(floor(x / Shape::CEll_SIZE)), 0, Shape::ROW_SIZE - 1);
+    }
+
+    uint FluidSnapshot::clampCellY(double y)
+    {
+        return std::clamp(static_cast<int>(floor(y / Shape::CEll_SIZE)), 0, Shape::COL_SIZE - 1);
+    }
+
+    void FluidSnapshot::cellRange(double left, double top, double right, double bottom,
+                                  uint& x0, uint& y0, uint& x1, uint& y1)
+    {
+        x0 = clampCellX(left);
+        y0 = clampCellY(top);
+        x1 = clampCellX(right);
+        y1 = clampCellY(bottom);
+    }
+
+    uint FluidSnapshot::countInRect(double left, double top, double right, double bottom) const
+    {
+        uint nb = 0;
+        forEachInRect(left, top, right, bottom, [&](const Sample&) { ++nb; });
+        return nb;
+    }
+
+    std::vector<FluidSnapshot::Sample> FluidSnapshot::nearest(double x, double y, uint k) const
+    {
+        std::vector<std::pair<double, uint>> candidates; // squared distance, sample
+        if (k == 0 || _samples.empty())
+            return {};
+
+        int cx = clampCellX(x);
+        int cy = clampCellY(y);
+        cdouble cell = Shape::CEll_SIZE;
+
+        // Rings of cells around the point, until nothing outside can be closer than the k-th found
+        for (int ring{};; ++ring)
+        {
+            int x0 = cx - ring, x1 = cx + ring;
+            int y0 = cy - ring, y1 = cy + ring;
+
+            for (int j{ y0 }; j <= y1; ++j)
+                for (int i{ x0 }; i <= x1; ++i)
+                {
+                    bool onRing = i == x0 || i == x1 || j == y0 || j == y1;
+                    if (!onRing || i < 0 || j < 0 || i >= Shape::ROW_SIZE || j >= Shape::COL_SIZE)
+                        continue;
+
+                    uint id = Shape::cellId(i, j);
+                    for (uint s{ _cellStart[id] }; s < _cellEnd[id]; ++s)
+                    {
+                        double tmpX = _samples[s].x - x;
+                        double tmpY = _samples[s].y - y;
+                        candidates.push_back({ tmpX * tmpX + tmpY * tmpY, s });
+                    }
+                }
+
+            bool everywhere = x0 <= 0 && y0 <= 0 && x1 >= Shape::ROW_SIZE - 1 && y1 >= Shape::COL_SIZE - 1;
+            if (everywhere)
+                break;
+
+            if (candidates.size() >= k)
+            {
+                // Distance from the point to the closest side of the searched square that has cells beyond it
+                double bound = 1e300;
+                if (x0 > 0) bound = std::min(bound, x - x0 * cell);
+                if (y0 > 0) bound = std::min(bound, y - y0 * cell);
+                if (x1 < Shape::ROW_SIZE - 1) bound = std::min(bound, (x1 + 1) * cell - x);
+                if (y1 < Shape::COL_SIZE - 1) bound = std::min(bound, (y1 + 1) * cell - y);
+                // Negative when the point is outside the grid and its cell was clamped
+                bound = std::max(bound, 0.0);
+
+                std::nth_element(candidates.begin(), candidates.begin() + (k - 1), candidates.end());
+                if (candidates[k - 1].first <= bound * bound)
+                    break;
+            }
+        }
+
+        uint nb = std::min<uint>(k, static_cast<uint>(candidates.size()));
+        std::partial_sort(candidates.begin(), candidates.begin() + nb, candidates.end());
+
+        std::vector<Sample> closest;
+        closest.reserve(nb);
+        for (uint n{}; n < nb; ++n)
+            closest.push_back(_samples[candidates[n].second]);
+        return closest;
+    }
+
+    double FluidSnapshot::density(double x, double y) const
+    {
+        cdouble poly6 = Kernels<2>::poly6(H);
+        double rho = 0;
+
+        forEachInRect(x - H, y - H, x + H, y + H, [&](const Sample& s)
+        {
+            double tmpX = s.x - x;
+            double tmpY = s.y - y;
+            double distanceSqrt = tmpX * tmpX + tmpY * tmpY;
+
+            if (distanceSqrt < HSQ)
+            {
+                double tmpProcess = HSQ - distanceSqrt;
+                rho += s.mass * poly6 * tmpProcess * tmpProcess * tmpProcess;
+            }
+        });
+
+        return rho;
+    }
+
+    void FluidSnapshot::velocity(double x, double y, double& vx, double& vy) const
+    {
+        double weights = 0;
+        vx = vy = 0;
+
+        forEachInRect(x - H, y - H, x + H, y + H, [&](const Sample& s)
+        {
+            double tmpX = s.x - x;
+            double tmpY = s.y - y;
+            double distanceSqrt = tmpX * tmpX + tmpY * tmpY;
+
+            if (distanceSqrt < HSQ)
+            {
+                double tmpProcess = HSQ - distanceSqrt;
+                double w = s.mass * tmpProcess * tmpProcess * tmpProcess;
+                vx += w * s.vx;
+                vy += w * s.vy;
+                weights += w;
+            }
+        });
+
+        if (weights > 0)
+        {
+            vx /= weights;
+            vy /= weights;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Read-only copy of the 2D particles taken by ParticleManager::update, sorted by cell.
+// A snapshot never changes once published, so any thread can query it while the
+// simulation goes on.
+
+#include <cstddef>
+#include <vector>
+
+#include "Globals.h"
+#include "Particle.h"
+#include "SpatialGrid.h"
+
+namespace SPH
+{
+    class FluidSnapshot
+    {
+        using cdouble = const double;
+        using Shape = SpatialGrid::Shape;
+
+        inline static cdouble H = Shape::CEll_SIZE; // kernel radius
+        inline static cdouble HSQ = H * H;
+
+    public:
+        struct Sample
+        {
+            double x, y;
+            double vx, vy;
+            double mass;
+        };
+
+        FluidSnapshot();
+
+        // Copies the particles in the order of the grid, which must have been built from them.
+        // materialMass is the mass of each material index.
+        void capture(const std::vector<Particle>&, const SpatialGrid&, const std::vector<double>& materialMass);
+
+        std::size_t size() const;
+
+        // Calls f with every sample inside the rectangle
+        template <typename F>
+        void forEachInRect(double left, double top, double right, double bottom, F&& f) const
+        {
+            uint x0, y0, x1, y1;
+            cellRange(left, top, right, bottom, x0, y0, x1, y1);
+
+            for (uint y{ y0 }; y <= y1; ++y)
+                for (uint x{ x0 }; x <= x1; ++x)
+                {
+                    uint id = Shape::cellId(x, y);
+                    for (uint i{ _cellStart[id] }; i < _cellEnd[id]; ++i)
+                    {
+                        const Sample& s = _samples[i];
+                        if (s.x >= left && s.x <= right && s.y >= top && s.y <= bottom)
+                            f(s);
+                    }
+                }
+        }
+
+        uint countInRect(double left, double top, double right, double bottom) const;
+
+        // The k closest samples, closest first
+        std::vector<Sample> nearest(double x, double y, uint k) const;
+
+        // Kernel weighted fields at any point, the same poly6 kernel as the simulation
+        double density(double x, double y) const;
+        // Mean velocity around the point, 0 where there is no fluid
+        void velocity(double x, double y, double& vx, double& vy) const;
+
+    private:
+        static uint clampCellX(double x);
+        static uint clampCellY(double y);
+        static void cellRange(double left, double top, double right, double bottom,
+                              uint& x0, uint& y0, uint& x1, uint& y1);
+
+        std::vector<Sample> _samples; // sorted by cell
+        std::vector<uint> _cellStart;
+        std::vector<uint> _cellEnd;
+    };
+}
@@ -0,0 +1,167 @@
+#include "FluidSurface.h"
+
+namespace SPH
+{
+    namespace
+    {
+        // 9 taps gaussian along direction, in texels
+        const char* blurShader = R"(
+#version 330
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec2 direction;
+
+out vec4 finalColor;
+
+void main()
+{
+    const float weights[5] = float[](0.227027, 0.194595, 0.121622, 0.054054, 0.016216);
+
+    float sum = texture(texture0, fragTexCoord).r * weights[0];
+    for (int i = 1; i < 5; ++i)
+    {
+        sum += texture(texture0, fragTexCoord + direction * float(i)).r * weights[i];
+        sum += texture(texture0, fragTexCoord - direction * float(i)).r * weights[i];
+    }
+
+    finalColor = vec4(sum, sum, sum, 1.0);
+}
+)";
+
+        // The thickness is a height field: its gradient gives the normal,
+        // a threshold gives the outline
+        const char* shadeShader = R"(
+#version 330
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec2 texel;
+
+out vec4 finalColor;
+
+void main()
+{
+    float t = texture(texture0, fragTexCoord).r;
+    float gx = texture(texture0, fragTexCoord + vec2(texel.x, 0.0)).r - texture(texture0, fragTexCoord - vec2(texel.x, 0.0)).r;
+    float gy = texture(texture0, fragTexCoord + vec2(0.0, texel.y)).r - texture(texture0, fragTexCoord - vec2(0.0, texel.y)).r;
+
+    vec3 normal = normalize(vec3(-gx * 8.0, -gy * 8.0, 1.0));
+    vec3 light = normalize(vec3(-0.4, 0.6, 1.0));
+    float diffuse = max(dot(normal, light), 0.0);
+    float specular = pow(max(dot(reflect(-light, normal), vec3(0.0, 0.0, 1.0)), 0.0), 24.0);
+
+    // Thin fluid is lighter, like water over a white floor
+    vec3 color = mix(vec3(1.0), fragColor.rgb, smoothstep(0.15, 0.8, t));
+    color = color * (0.55 + 0.45 * diffuse) + vec3(specular * 0.6);
+
+    finalColor = vec4(color, smoothstep(0.12, 0.2, t));
+}
+)";
+    }
+
+    FluidSurface::FluidSurface()
+        : _thickness{}
+        , _blurred{}
+        , _disc{}
+        , _blurShader{}
+        , _shadeShader{}
+        , _directionLoc(-1)
+        , _texelLoc(-1)
+    {}
+
+    FluidSurface::~FluidSurface()
+    {
+        // Past CloseWindow the context is gone, and with it what was loaded
+        if (_thickness.id == 0 || !IsWindowReady())
+            return;
+
+        UnloadRenderTexture(_thickness);
+        UnloadRenderTexture(_blurred);
+        UnloadTexture(_disc);
+        UnloadShader(_blurShader);
+        UnloadShader(_shadeShader);
+    }
+
+    void FluidSurface::load()
+    {
+        _thickness = LoadRenderTexture(WIDTH, HEIGHT);
+        _blurred = LoadRenderTexture(WIDTH, HEIGHT);
+        SetTextureFilter(_thickness.texture, TEXTURE_FILTER_BILINEAR);
+        SetTextureFilter(_blurred.texture, TEXTURE_FILTER_BILINEAR);
+
+        Image disc = GenImageGradientRadial(SPLAT_SIZE, SPLAT_SIZE, 0.0f, WHITE, BLANK);
+        _disc = LoadTextureFromImage(disc);
+        UnloadImage(disc);
+        SetTextureFilter(_disc, TEXTURE_FILTER_BILINEAR);
+
+        _blurShader = LoadShaderFromMemory(nullptr, blurShader);
+        _directionLoc = GetShaderLocation(_blurShader, "direction");
+        _shadeShader = LoadShaderFromMemory(nullptr, shadeShader);
+        _texelLoc = GetShaderLocation(_shadeShader, "texel");
+    }
+
+    void FluidSurface::splat(const std::vector<Particle>& particles, float radius)
+    {
+        // Discs added on top of each other, all from one texture so raylib batches them
+        float size = 2 * radius / DOWNSAMPLE;
+        Rectangle source{ 0, 0, (float)SPLAT_SIZE, (float)SPLAT_SIZE };
+        Color weight{ 255, 255, 255, 60 };
+
+        BeginTextureMode(_thickness);
+        ClearBackground(BLACK);
+        BeginBlendMode(BLEND_ADDITIVE);
+
+        for (const Particle& p : particles)
+        {
+            Rectangle dest{ (float)p.x / DOWNSAMPLE - size / 2, (float)p.y / DOWNSAMPLE - size / 2, size, size };
+            DrawTexturePro(_disc, source, dest, Vector2{}, 0, weight);
+        }
+
+        EndBlendMode();
+        EndTextureMode();
+    }
+
+    void FluidSurface::blur(const RenderTexture2D& from, const RenderTexture2D& to, float dx, float dy)
+    {
+        // Render textures are stored upside down, the negative height puts them back
+        Vector2 direction{ dx / WIDTH, dy / HEIGHT };
+        SetShaderValue(_blurShader, _directionLoc, &direction, SHADER_UNIFORM_VEC2);
+
+        BeginTextureMode(to);
+        BeginShaderMode(_blurShader);
+        DrawTextureRec(from.texture, Rectangle{ 0, 0, (float)WIDTH, -(float)HEIGHT }, Vector2{}, WHITE);
+        EndShaderMode();
+        EndTextureMode();
+    }
+
+    void FluidSurface::prepare(const std::vector<Particle>& particles, float radius)
+    {
+        if (_thickness.id == 0)
+            load();
+
+        splat(particles, radius);
+        blur(_thickness, _blurred, 1, 0);
+        blur(_blurred, _thickness, 0, 1);
+    }
+
+    void FluidSurface::render(Color color)
+    {
+        if (_thickness.id == 0)
+            return;
+
+        Vector2 texel{ 1.0f / WIDTH, 1.0f / HEIGHT };
+        SetShaderValue(_shadeShader, _texelLoc, &texel, SHADER_UNIFORM_VEC2);
+
+        color.a = 255;
+        BeginShaderMode(_shadeShader);
+        Rectangle source{ 0, 0, (float)WIDTH, -(float)HEIGHT };
+        Rectangle dest{ 0, 0, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT };
+        DrawTexturePro(_thickness.texture, source, dest, Vector2{}, 0, color);
+        EndShaderMode();
+    }
+}
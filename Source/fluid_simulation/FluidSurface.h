@@ -0,0 +1,51 @@
+#pragma once
+
+// Screen-space surface of the 2D fluid: the particles are splatted as soft discs
+// into a thickness buffer, which is blurred in two separable passes and shaded
+// as a height field. Past the splat, the cost only depends on the resolution.
+
+#include <vector>
+#include <raylib.h>
+
+#include "Globals.h"
+#include "Particle.h"
+
+namespace SPH
+{
+    class FluidSurface
+    {
+        using cint = const int;
+
+        inline static cint DOWNSAMPLE = 2; // screen pixels per buffer pixel, on each side
+        inline static cint WIDTH = SCREEN_WIDTH / DOWNSAMPLE;
+        inline static cint HEIGHT = SCREEN_HEIGHT / DOWNSAMPLE;
+        inline static cint SPLAT_SIZE = 32; // of the disc texture
+
+    public:
+        FluidSurface();
+        ~FluidSurface();
+
+        FluidSurface(const FluidSurface&) = delete;
+        FluidSurface& operator=(const FluidSurface&) = delete;
+
+        // Splats and blurs into the offscreen buffers, before the frame target is bound.
+        // radius is the radius of a splat on screen.
+        void prepare(const std::vector<Particle>&, float radius);
+        // Shades the prepared buffer over the screen
+        void render(Color color);
+
+    private:
+        void load();
+        void splat(const std::vector<Particle>&, float radius);
+        void blur(const RenderTexture2D& from, const RenderTexture2D& to, float dx, float dy);
+
+        // Created by the first render, the window must exist
+        RenderTexture2D _thickness;
+        RenderTexture2D _blurred;
+        Texture2D _disc;
+        Shader _blurShader;
+        Shader _shadeShader;
+        int _directionLoc;
+        int _texelLoc;
+    };
+}
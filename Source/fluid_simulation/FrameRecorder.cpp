@@ -0,0 +1,303 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <rlgl.h>
+#include <external/glad.h> // the OpenGL functions loaded by raylib
+
+using namespace std;
+
+namespace SPH
+{
+    namespace
+    {
+        double now()
+        {
+            return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    FrameRecorder::FrameRecorder()
+        : _format(Format::Png)
+        , _recording(false)
+        , _captured(0)
+        , _dropped(0)
+        , _target{}
+        , _readBuffers{}
+        , _readTimes{}
+        , _nextRead(0)
+        , _pendingReads(0)
+        , _stop(false)
+        , _encoded(0)
+        , _firstTime(0)
+        , _gifCentiSeconds(0)
+        , _gifFile(nullptr)
+        , _gif{}
+    {}
+
+    FrameRecorder::~FrameRecorder()
+    {
+        stop();
+
+        // Past CloseWindow the context is gone, and with it what was loaded
+        if (_target.id != 0 && IsWindowReady())
+        {
+            UnloadRenderTexture(_target);
+            glDeleteBuffers(READ_BUFFERS, _readBuffers);
+        }
+    }
+
+    bool FrameRecorder::start(Format format, const string& name)
+    {
+        if (_recording)
+            return false;
+
+        if (format == Format::Gif)
+        {
+            _gifFile = fopen(name.c_str(), "wb");
+            if (!_gifFile)
+            {
+                cout << "cannot write " << name << endl;
+                return false;
+            }
+        }
+
+        _format = format;
+        _name = name;
+        _captured = _dropped = _encoded = 0;
+        _nextRead = _pendingReads = 0;
+        _gifCentiSeconds = 0;
+        _gif = {};
+        _stop = false;
+        _recording = true;
+        _encoder = thread(&FrameRecorder::encoderLoop, this);
+
+        cout << "recording " << name << endl;
+        return true;
+    }
+
+    void FrameRecorder::stop()
+    {
+        if (!_recording)
+            return;
+
+        // The last frames are still in the pixel buffers, lost when the window is already closed
+        while (_pendingReads > 0 && IsWindowReady())
+            collectRead();
+        _pendingReads = 0;
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_one();
+        _encoder.join();
+        _recording = false;
+
+        cout << "recorded " << _encoded << " frames in " << _name << ", " << _dropped << " dropped" << endl;
+    }
+
+    bool FrameRecorder::isRecording() const
+    {
+        return _recording;
+    }
+
+    uint FrameRecorder::getCaptured() const
+    {
+        return _captured;
+    }
+
+    uint FrameRecorder::getDropped() const
+    {
+        return _dropped;
+    }
+
+    void FrameRecorder::beginFrame()
+    {
+        if (_target.id == 0)
+        {
+            _target = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+            glGenBuffers(READ_BUFFERS, _readBuffers);
+            for (uint buffer : _readBuffers)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, SCREEN_WIDTH * SCREEN_HEIGHT * 4, nullptr, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        BeginTextureMode(_target);
+    }
+
+    void FrameRecorder::endFrame()
+    {
+        // With the ring full, the oldest read back is READ_BUFFERS frames old and done by now
+        if (_pendingReads == READ_BUFFERS)
+            collectRead();
+
+        // The read back is skipped too when the frame would be dropped
+        if (isFull())
+            ++_dropped;
+        else
+        {
+            // The target is still bound: its batch is drawn, then the GPU copies it into the
+            // buffer on its own and glReadPixels returns at once
+            rlDrawRenderBatchActive();
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, _readBuffers[_nextRead]);
+            glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            _readTimes[_nextRead] = now();
+            _nextRead = (_nextRead + 1) % READ_BUFFERS;
+            ++_pendingReads;
+        }
+
+        EndTextureMode();
+
+        Rectangle source{ 0, 0, (float)SCREEN_WIDTH, -(float)SCREEN_HEIGHT };
+        DrawTextureRec(_target.texture, source, Vector2{}, WHITE);
+    }
+
+    void FrameRecorder::submit(Image frame, double time)
+    {
+        if (!_recording)
+        {
+            UnloadImage(frame);
+            return;
+        }
+
+        {
+            unique_lock<mutex> lock(_mutex);
+            _room.wait(lock, [&] { return _queue.size() < QUEUE_SIZE; });
+        }
+        push({ frame, false, time });
+    }
+
+    bool FrameRecorder::isFull()
+    {
+        // The frames being read back will be queued too
+        lock_guard<mutex> lock(_mutex);
+        return _queue.size() + _pendingReads >= QUEUE_SIZE;
+    }
+
+    void FrameRecorder::collectRead()
+    {
+        uint slot = (_nextRead + READ_BUFFERS - _pendingReads) % READ_BUFFERS;
+        --_pendingReads;
+
+        cuint size = SCREEN_WIDTH * SCREEN_HEIGHT * 4;
+        Image image{ MemAlloc(size), SCREEN_WIDTH, SCREEN_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _readBuffers[slot]);
+        void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            memcpy(image.data, pixels, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (pixels)
+            push({ image, true, _readTimes[slot] });
+        else
+        {
+            ++_dropped;
+            UnloadImage(image);
+        }
+    }
+
+    void FrameRecorder::push(const Frame& frame)
+    {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _queue.push_back(frame);
+        }
+        ++_captured;
+        _wake.notify_one();
+    }
+
+    void FrameRecorder::encoderLoop()
+    {
+        // A frame is encoded once the next one arrives, to know how long it lasts
+        bool holding = false;
+        Frame held{};
+        double lastDuration = 1.0 / 30;
+
+        for (;;)
+        {
+            Frame frame;
+            {
+                unique_lock<mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _stop || !_queue.empty(); });
+
+                if (_queue.empty())
+                    break;
+
+                frame = _queue.front();
+                _queue.pop_front();
+            }
+            _room.notify_one();
+
+            if (holding)
+            {
+                lastDuration = frame.time - held.time;
+                encode(held, frame.time);
+            }
+            else
+                _firstTime = frame.time;
+
+            held = frame;
+            holding = true;
+        }
+
+        if (holding)
+            encode(held, held.time + lastDuration);
+
+        if (_gifFile)
+        {
+            // The GIF is begun by its first frame
+            if (_encoded > 0)
+                msf_gif_end_to_file(&_gif);
+            fclose(_gifFile);
+            _gifFile = nullptr;
+        }
+    }
+
+    void FrameRecorder::encode(Frame& frame, double end)
+    {
+        Image& image = frame.image;
+        if (image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+            ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+        if (_format == Format::Png)
+        {
+            if (frame.bottomUp)
+                ImageFlipVertical(&image);
+
+            char fileName[512];
+            snprintf(fileName, sizeof(fileName), "%s_%05u.png", _name.c_str(), _encoded);
+            ExportImage(image, fileName);
+        }
+        else
+        {
+            if (_encoded == 0)
+                msf_gif_begin_to_file(&_gif, image.width, image.height, (MsfGifFileWriteFunc)fwrite, _gifFile);
+
+            // A negative pitch reads the rows from the last one
+            int pitch = frame.bottomUp ? -image.width * 4 : image.width * 4;
+
+            // GIF delays are in hundredths of a second, the rounding is carried over to the next frames
+            int centiSeconds = std::max(1, static_cast<int>(lround((end - _firstTime) * 100)) - _gifCentiSeconds);
+            _gifCentiSeconds += centiSeconds;
+
+            msf_gif_frame_to_file(&_gif, static_cast<uint8_t*>(image.data), centiSeconds, GIF_BIT_DEPTH, pitch);
+        }
+
+        UnloadImage(image);
+        ++_encoded;
+    }
+}
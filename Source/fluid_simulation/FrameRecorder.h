@@ -0,0 +1,105 @@
+#pragma once
+
+// Records the frames of a run as a PNG sequence or a GIF.
+// The frame is drawn into a render texture, read back, and handed to an encoder
+// thread through a bounded queue. The read back goes to a ring of pixel buffers
+// and is collected a few frames later, so the GPU is never waited for. When the encoder falls behind, new frames are
+// dropped instead of making the render wait; a GIF shows the frame before a gap
+// for longer so the playback keeps the speed of the run.
+// Frames rendered without a GPU are handed over with submit, which waits for the
+// encoder instead, as nothing is shown meanwhile.
+
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <raylib.h>
+#include <external/msf_gif.h>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    class FrameRecorder
+    {
+        using cuint = const uint;
+
+        inline static cuint QUEUE_SIZE = 8;    // frames waiting for the encoder
+        inline static const int GIF_BIT_DEPTH = 16;
+        inline static cuint READ_BUFFERS = 3;  // read backs in flight
+
+    public:
+        enum class Format { Png, Gif };
+
+        FrameRecorder();
+        ~FrameRecorder();
+
+        FrameRecorder(const FrameRecorder&) = delete;
+        FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+        // name is the file of a GIF, or the start of the file names of a PNG sequence
+        bool start(Format, const std::string& name);
+        // Waits for the frames already queued
+        void stop();
+        bool isRecording() const;
+
+        // Around the drawing of a frame: draws into the offscreen target, then
+        // queues it and shows it on the screen. Needs the window.
+        void beginFrame();
+        void endFrame();
+
+        // Queues a frame made on the CPU, top row first, time is the second of the run it shows.
+        // The recorder owns it from now on, it is unloaded when not recording.
+        void submit(Image frame, double time);
+
+        uint getCaptured() const;
+        uint getDropped() const;
+
+    private:
+        struct Frame
+        {
+            Image image;
+            bool bottomUp; // read back from a render texture
+            double time;   // seconds, when it was queued
+        };
+
+        bool isFull();
+        void push(const Frame&);
+
+        // Maps the pixel buffer of the oldest read back and queues its frame
+        void collectRead();
+
+        void encoderLoop();
+        void encode(Frame&, double end); // end: when the next frame replaces it
+
+        Format _format;
+        std::string _name;
+        bool _recording;
+        uint _captured;
+        uint _dropped;
+
+        RenderTexture2D _target; // created by the first beginFrame
+
+        // Ring of pixel buffers, the reads in flight end at _nextRead
+        uint _readBuffers[READ_BUFFERS];
+        double _readTimes[READ_BUFFERS];
+        uint _nextRead;
+        uint _pendingReads;
+
+        std::thread _encoder;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _room; // a frame left the queue
+        std::deque<Frame> _queue;
+        bool _stop;
+
+        // Encoder thread only
+        uint _encoded;
+        double _firstTime;
+        int _gifCentiSeconds; // written so far
+        FILE* _gifFile;
+        MsfGifState _gif;
+    };
+}
@@ -1,6 +1,8 @@
 #include "GameSPH.h"
 
 #include <algorithm>
+#include <ctime>
+#include <string>
 #include <raylib.h>
 #include <Code_Utilities_Light_v2.h>
 
@@ -12,20 +14,33 @@ using namespace std;
 
 namespace SPH
 {
-    GameSPH::GameSPH()
-        : _pause(false)
-        , _nextCmdIndex(0)
+    GameSPH::Window::Window()
     {
         InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, WINDOW_TITLE);
         SetTargetFPS(FPS); // Set our game to run at 30 frames-per-second
+    }
 
+    GameSPH::Window::~Window()
+    {
+        CloseWindow();
+    }
+
+    GameSPH::GameSPH()
+        : _pause(false)
+        , _showStats(false)
+        , _volumeMode(false)
+        , _settledStart(false)
+        , _brush(Brush::Particles)
+        , _stroke(nullptr)
+        , _nextCmdIndex(0)
+    {
         _particleManager.init(presets[1]);
+        _volumeManager.init(presets[1]);
     }
 
     GameSPH::~GameSPH()
     {
-        CloseWindow();
-
+        delete _stroke;
         clearHistory(0);
         _nextCmdIndex = 0;
     }
@@ -45,13 +60,46 @@ namespace SPH
         // Mouse
         int x = getClickX(), y = getClickY();
 
-        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
-            addCommand(new CmdAddGroup{_particleManager, x, y });
-        else if (IsMouseButtonPressed(MOUSE_RIGHT_BUTTON))
-            addCommand(new CmdAddOne{ _particleManager, x, y });
+        // Particles are only added in the 2D simulation
+        if (!_volumeMode)
+        {
+            if (_brush != Brush::Particles && IsMouseButtonDown(MOUSE_LEFT_BUTTON))
+            {
+                // One command for the whole drag
+                if (!_stroke)
+                    _stroke = new CmdBrush{ _particleManager, _brush == Brush::Push ? 1.0f : -1.0f };
+                _stroke->addSample(x, y);
+            }
+            else if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+                addCommand(new CmdAddGroup{_particleManager, x, y });
+            else if (IsMouseButtonPressed(MOUSE_RIGHT_BUTTON))
+                addCommand(new CmdAddOne{ _particleManager, x, y });
+        }
+
+        if (_stroke && (_volumeMode || !IsMouseButtonDown(MOUSE_LEFT_BUTTON)))
+        {
+            recordCommand(_stroke);
+            _stroke = nullptr;
+        }
+
+        // An image dropped on the window becomes the obstacles
+        if (IsFileDropped())
+        {
+            int count = 0;
+            char** files = GetDroppedFiles(&count);
+            if (count > 0 && IsFileExtension(files[0], ".scene"))
+                loadScene(files[0]);
+            else if (count > 0 && !_particleManager.loadObstacleMask(files[0]))
+                cout << "Cannot load obstacle mask " << files[0] << endl;
+            ClearDroppedFiles();
+        }
 
         // Key pressed
         int key = GetKeyPressed();
+
+        if (_volumeMode && handleVolumeInput(key))
+            return;
+
         switch (key)
         {
             // Control
@@ -70,6 +118,24 @@ namespace SPH
         case KEY_DOWN:
             _particleManager.setGravity(DOWN);
             break;
+        case KEY_G:
+            if (_particleManager.getGridBackend() == GridBackend::Serial)
+            {
+                _particleManager.setGridBackend(GridBackend::ParallelRadix);
+                _volumeManager.setGridBackend(GridBackend::ParallelRadix);
+                cout << "Grid backend: parallel radix sort" << endl;
+            }
+            else
+            {
+                _particleManager.setGridBackend(GridBackend::Serial);
+                _volumeManager.setGridBackend(GridBackend::Serial);
+                cout << "Grid backend: serial counting sort" << endl;
+            }
+            break;
+        case KEY_V:
+            _volumeMode = !_volumeMode;
+            cout << (_volumeMode ? "3D simulation" : "2D simulation") << endl;
+            break;
 
             // Display
         case KEY_A:
@@ -81,11 +147,102 @@ namespace SPH
         case KEY_D:
             _particleManager.setRenderMode((uchar)Render::DrawGrid);
             break;
+        case KEY_H:
+            _particleManager.setRenderMode((uchar)Render::Density);
+            break;
+        case KEY_R:
+            _particleManager.setRenderMode((uchar)Render::Surface);
+            break;
 
             // Game Handle
         case KEY_P:
             _pause = !_pause;
             break;
+        case KEY_O:
+            if (_particleManager.hasObstacles())
+                _particleManager.clearObstacles();
+            else
+                _particleManager.loadObstacles(obstaclesPreset);
+            break;
+        case KEY_Y:
+            _settledStart = !_settledStart;
+            cout << "Presets start " << (_settledStart ? "at rest" : "as a falling disc") << endl;
+            break;
+        case KEY_I:
+            {
+                static const char* names[] = { "material", "speed", "pressure", "density" };
+                uint mode = ((uint)_particleManager.getColorMode() + 1) % (uint)ColorMode::Count;
+                _particleManager.setColorMode((ColorMode)mode);
+                cout << "Particle color: " << names[mode] << endl;
+            } break;
+        case KEY_L:
+            if (_particleManager.getIntegrator() == Integrator::SemiImplicitEuler)
+            {
+                _particleManager.setIntegrator(Integrator::Leapfrog);
+                cout << "Integrator: leapfrog" << endl;
+            }
+            else
+            {
+                _particleManager.setIntegrator(Integrator::SemiImplicitEuler);
+                cout << "Integrator: semi-implicit Euler" << endl;
+            }
+            break;
+        case KEY_X:
+            _particleManager.setXsph(_particleManager.getXsph() > 0 ? 0 : ParticleManager::XSPH_EPSILON);
+            cout << "XSPH: " << _particleManager.getXsph() << endl;
+            break;
+        case KEY_K:
+            _particleManager.setArtificialViscosity(_particleManager.getArtificialViscosity() > 0 ? 0 : ParticleManager::ARTIFICIAL_ALPHA);
+            cout << "Artificial viscosity: " << _particleManager.getArtificialViscosity() << endl;
+            break;
+        case KEY_KP_ADD:
+            _particleManager.setSlowMotion(std::max(_particleManager.getSlowMotion() * 0.5f, 1.0f));
+            cout << "Slow motion: " << _particleManager.getSlowMotion() << endl;
+            break;
+        case KEY_KP_SUBTRACT:
+            _particleManager.setSlowMotion(std::min(_particleManager.getSlowMotion() * 2.0f, 40.0f));
+            cout << "Slow motion: " << _particleManager.getSlowMotion() << endl;
+            break;
+        case KEY_F:
+            _particleManager.setSurfaceTension(!_particleManager.getSurfaceTension());
+            cout << "Surface tension: " << (_particleManager.getSurfaceTension() ? "on" : "off") << endl;
+            break;
+        case KEY_N:
+            _brush = _brush == Brush::Particles ? Brush::Push : _brush == Brush::Push ? Brush::Attract : Brush::Particles;
+            cout << "Mouse: " << (_brush == Brush::Particles ? "add particles" : _brush == Brush::Push ? "push" : "attract") << endl;
+            break;
+        case KEY_M:
+            _particleManager.setSpawnMaterial(_particleManager.getSpawnMaterial() + 1);
+            cout << "New particles: " << ParticleManager::MATERIALS[_particleManager.getSpawnMaterial()].name << endl;
+            break;
+        case KEY_E:
+            if (_particleManager.hasEmitters())
+                _particleManager.clearEmitters();
+            else
+            {
+                // A jet from the top left corner, drained at the bottom right
+                _particleManager.addEmitter(40, 100, 3000, 0, 40, 800);
+                _particleManager.addSink(SCREEN_WIDTH - 120, SCREEN_HEIGHT - 60, SCREEN_WIDTH, SCREEN_HEIGHT);
+            }
+            break;
+        case KEY_B:
+            _particleManager.setObstaclePressure(!_particleManager.getObstaclePressure());
+            cout << "Obstacle pressure: " << (_particleManager.getObstaclePressure() ? "on" : "off") << endl;
+            break;
+        case KEY_W:
+            _particleManager.setBoundaryParticles(!_particleManager.getBoundaryParticles());
+            cout << "Boundary particles: " << (_particleManager.getBoundaryParticles() ? "on" : "off") << endl;
+            break;
+        case KEY_Q:
+            _particleManager.setSleeping(!_particleManager.getSleeping());
+            cout << "Sleeping regions: " << (_particleManager.getSleeping() ? "on" : "off") << endl;
+            break;
+        case KEY_T:
+            _showStats = !_showStats;
+            break;
+        case KEY_U:
+            toggleRecording(IsKeyDown(KEY_LEFT_SHIFT) ? FrameRecorder::Format::Png : FrameRecorder::Format::Gif);
+            break;
         case KEY_ESCAPE:
             _keepPlaying = false;
             break;
@@ -107,7 +264,10 @@ namespace SPH
         case KEY_KP_7:
         case KEY_KP_8:
         case KEY_KP_9:
-            _particleManager.init(presets[key - KeyboardKey::KEY_KP_1]);
+            if (_settledStart)
+                _particleManager.initSettled(presets[key - KeyboardKey::KEY_KP_1]);
+            else
+                _particleManager.init(presets[key - KeyboardKey::KEY_KP_1]);
             clearHistory(0);
             _nextCmdIndex = 0;
             _particleManager.setDefaultColor();
@@ -125,33 +285,201 @@ namespace SPH
         }
     }
 
+    bool GameSPH::handleVolumeInput(int key)
+    {
+        switch (key)
+        {
+        case KEY_SPACE:
+            _volumeManager.explode();
+            return true;
+        case KEY_LEFT:
+            _volumeManager.setGravity(LEFT);
+            return true;
+        case KEY_RIGHT:
+            _volumeManager.setGravity(RIGHT);
+            return true;
+        case KEY_UP:
+            _volumeManager.setGravity(UP);
+            return true;
+        case KEY_DOWN:
+            _volumeManager.setGravity(DOWN);
+            return true;
+
+        case KEY_KP_1:
+        case KEY_KP_2:
+        case KEY_KP_3:
+        case KEY_KP_4:
+        case KEY_KP_5:
+        case KEY_KP_6:
+        case KEY_KP_7:
+        case KEY_KP_8:
+        case KEY_KP_9:
+            _volumeManager.init(presets[key - KeyboardKey::KEY_KP_1]);
+            return true;
+
+            // Commands and display modes of the 2D simulation
+        case KEY_A:
+        case KEY_S:
+        case KEY_D:
+        case KEY_H:
+        case KEY_R:
+        case KEY_C:
+        case KEY_Q:
+        case KEY_O:
+        case KEY_B:
+        case KEY_E:
+        case KEY_N:
+        case KEY_F:
+        case KEY_L:
+        case KEY_I:
+        case KEY_Y:
+        case KEY_X:
+        case KEY_K:
+        case KEY_KP_ADD:
+        case KEY_KP_SUBTRACT:
+        case KEY_M:
+        case KEY_W:
+        case KEY_Z:
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
     void GameSPH::update()
     {
         if (_pause)
             return;
 
-        _particleManager.update();
+        if (_volumeMode)
+            _volumeManager.update();
+        else
+            _particleManager.update();
     }
 
     void GameSPH::render()
     {
+        if (!_volumeMode)
+            _particleManager.prepareRender();
+
         BeginDrawing();
         {
+            if (_recorder.isRecording())
+                _recorder.beginFrame();
+
             // Clear screen
             ClearBackground(Color{ 220, 220, 220, 255 });
 
             // Draw particles
-            _particleManager.render();
+            if (_volumeMode)
+                _volumeManager.render();
+            else
+                _particleManager.render();
+
+            if (!_volumeMode && _brush != Brush::Particles)
+                DrawCircleLines(GetMouseX(), GetMouseY(), (float)ParticleManager::BRUSH_RADIUS, DARKGRAY);
 
             DrawFPS(20, 20);
+
+            if (_showStats)
+                renderStats();
+
+            // The frame goes to the recorder without the indicator
+            if (_recorder.isRecording())
+            {
+                _recorder.endFrame();
+                DrawCircle(SCREEN_WIDTH - 20, 20, 6, RED);
+                DrawText(TextFormat("%u frames, %u dropped", _recorder.getCaptured(), _recorder.getDropped()),
+                         SCREEN_WIDTH - 180, 15, 10, DARKGRAY);
+            }
         }
         EndDrawing();
     }
 
+    void GameSPH::loadScene(const std::string& fileName)
+    {
+        Scene scene;
+        std::string error;
+        if (!scene.load(fileName, error))
+        {
+            cout << "Cannot load scene " << fileName << ", " << error << endl;
+            return;
+        }
+
+        if (!_particleManager.loadScene(scene))
+            cout << "Some obstacles of " << fileName << " could not be read" << endl;
+
+        clearHistory(0);
+        _nextCmdIndex = 0;
+    }
+
+    void GameSPH::toggleRecording(FrameRecorder::Format format)
+    {
+        if (_recorder.isRecording())
+        {
+            _recorder.stop();
+            return;
+        }
+
+        std::string name = TextFormat("capture_%ld", (long)time(nullptr));
+        if (format == FrameRecorder::Format::Gif)
+            name += ".gif";
+
+        _recorder.start(format, name);
+    }
+
+    void GameSPH::renderStats()
+    {
+        // Busy time of each worker in the density and force passes, to see the load imbalance
+        const std::vector<double>& busy = _particleManager.getWorkerBusyTimes();
+
+        double total = 0, slowest = 0;
+        for (double t : busy)
+        {
+            total += t;
+            slowest = std::max(slowest, t);
+        }
+
+        int y = 45;
+        for (size_t i{}; i < busy.size(); ++i, y += 15)
+            DrawText(TextFormat("Thread %d: %.2f ms", (int)i, busy[i] * 1000), 20, y, 10, DARKGRAY);
+
+        double imbalance = total > 0 ? slowest * busy.size() / total : 1.0;
+        DrawText(TextFormat("Imbalance: %.2f  Steals: %u", imbalance, _particleManager.getStealCount()), 20, y, 10, DARKGRAY);
+
+        // Where the frame goes, the draw calls are only sent to the GPU in the render phases
+        const PhaseTimers& timers = _particleManager.getPhaseTimers();
+        for (uchar p{}; p < (uchar)Phase::Count; ++p)
+        {
+            y += 15;
+            DrawText(TextFormat("%s: %.2f ms", PhaseTimers::name((Phase)p), timers.get((Phase)p) * 1000), 20, y, 10, DARKGRAY);
+        }
+        if (_particleManager.isLodActive())
+        {
+            y += 15;
+            DrawText("Particles drawn aggregated (level of detail)", 20, y, 10, DARKGRAY);
+        }
+
+        // Fluid under the cursor
+        std::shared_ptr<const FluidSnapshot> snapshot = _particleManager.getSnapshot();
+        double mouseX = GetMouseX(), mouseY = GetMouseY(), r = ParticleManager::BRUSH_RADIUS;
+        std::vector<FluidSnapshot::Sample> closest = snapshot->nearest(mouseX, mouseY, 1);
+        double nearest = closest.empty() ? 0 : hypot(closest[0].x - mouseX, closest[0].y - mouseY);
+
+        DrawText(TextFormat("Cursor: density %.3f  %u particles around  nearest at %.1f px",
+                            snapshot->density(mouseX, mouseY), snapshot->countInRect(mouseX - r, mouseY - r, mouseX + r, mouseY + r), nearest),
+                 20, y + 15, 10, DARKGRAY);
+    }
+
     void GameSPH::addCommand(ICommand* cmd)
     {
         cmd->execute();
-        
+        recordCommand(cmd);
+    }
+
+    void GameSPH::recordCommand(ICommand* cmd)
+    {
         // Flush all entries after last executed cmd
         clearHistory(_nextCmdIndex);
         _cmdHistory.push_back(cmd);
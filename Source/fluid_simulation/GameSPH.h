@@ -4,6 +4,8 @@
 
 #include "Game.h"
 #include "ParticleManager.h"
+#include "ParticleManager3D.h"
+#include "FrameRecorder.h"
 #include "Globals.h"
 
 using namespace Core;
@@ -11,6 +13,7 @@ using namespace Core;
 namespace SPH
 {
     class ICommand;
+    class CmdBrush;
     class GameSPH final : public Game 
     {
         enum {PRESET=9};
@@ -28,18 +31,51 @@ namespace SPH
     private:
         inline static const uint FPS = 30;
 
+        // Opened before the other members and closed after them, so they can free what they loaded
+        struct Window
+        {
+            Window();
+            ~Window();
+        };
+        Window _window;
+
         bool _pause;
+        bool _showStats;
+        bool _volumeMode; // 3D simulation instead of the 2D one
+        bool _settledStart; // the presets start with the 2D fluid at rest
+
+        // What the left mouse button does
+        enum class Brush { Particles, Push, Attract };
+        Brush _brush;
+        CmdBrush* _stroke; // brush being dragged, recorded when released
         inline static PresetList presets = {1, 200, 400, 700, 900, 1500, 2000, 3000, 5000};
+        inline static const char* obstaclesPreset =
+            "circle 360 330 45\n"
+            "box 80 250 260 270\n"
+            "segment 470 180 660 260 14\n";
         ParticleManager _particleManager;
+        ParticleManager3D _volumeManager;
 
         int getClickX();
         int getClickY();
 
+        void renderStats();
+
+        // Frames of the run written to capture_<time>.gif or capture_<time>_<frame>.png
+        FrameRecorder _recorder;
+        void toggleRecording(FrameRecorder::Format);
+
+        void loadScene(const std::string& fileName);
+
+        // Keys acting on the 3D simulation, returns false for the keys shared with the 2D one
+        bool handleVolumeInput(int key);
+
     private:
         uint _nextCmdIndex;
         CommandList _cmdHistory;
 
         void addCommand(ICommand* cmd);
+        void recordCommand(ICommand* cmd); // already executed
         void undo();
         void redo();
         void clearHistory(uint index);
@@ -9,9 +9,11 @@ namespace SPH
     static const char* WINDOW_TITLE = "Smoothed-particle hydrodynamics simulation";
     const int SCREEN_WIDTH  = 720;
     const int SCREEN_HEIGHT = 480;
+    const int SCREEN_DEPTH  = 160; // depth of the 3D volume, seen from the front
 
     const int DOWN  = 0;
     const int UP    = 1;
     const int LEFT  = 2;
     const int RIGHT = 3;
+    const int NO_GRAVITY = 4;
 }
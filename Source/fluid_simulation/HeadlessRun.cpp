@@ -0,0 +1,155 @@
+#include "HeadlessRun.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "FrameRecorder.h"
+#include "ParticleManager.h"
+#include "SoftwareRenderer.h"
+
+using namespace std;
+
+namespace SPH
+{
+    bool HeadlessOptions::parse(int argc, char** argv)
+    {
+        for (int i{ 1 }; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (strcmp(arg, "--headless") == 0)
+                continue;
+            if (strcmp(arg, "--settled") == 0)
+            {
+                settled = true;
+                continue;
+            }
+            if (!value)
+                return false;
+
+            if (strcmp(arg, "--particles") == 0)
+                particles = strtoul(value, nullptr, 10);
+            else if (strcmp(arg, "--scene") == 0)
+                scene = value;
+            else if (strcmp(arg, "--frames") == 0)
+                frames = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--every") == 0)
+                every = static_cast<uint>(strtoul(value, nullptr, 10));
+            else if (strcmp(arg, "--output") == 0)
+                output = value;
+            else if (strcmp(arg, "--format") == 0 && (strcmp(value, "png") == 0 || strcmp(value, "qoi") == 0))
+                format = value;
+            else if (strcmp(arg, "--record") == 0 && (strcmp(value, "gif") == 0 || strcmp(value, "png") == 0))
+                record = value;
+            else if (strcmp(arg, "--view") == 0 && strcmp(value, "particles") == 0)
+                view = (uchar)Render::Particles;
+            else if (strcmp(arg, "--view") == 0 && strcmp(value, "cells") == 0)
+                view = (uchar)Render::DrawGrid;
+            else
+                return false;
+
+            ++i;
+        }
+
+        return true;
+    }
+
+    HeadlessRun::HeadlessRun(const HeadlessOptions& options)
+        : _options(options)
+    {}
+
+    int HeadlessRun::run()
+    {
+        using Clock = chrono::steady_clock;
+        auto seconds = [](Clock::time_point since) { return chrono::duration<double>(Clock::now() - since).count(); };
+
+        ParticleManager particleManager;
+        particleManager.setRenderMode(_options.view);
+
+        if (_options.scene.empty() && _options.settled)
+        {
+            auto start = Clock::now();
+            bool cached = particleManager.initSettled(_options.particles);
+            cout << "settled start: " << seconds(start) * 1000 << " ms" << (cached ? ", from the cache" : "") << endl;
+        }
+        else if (_options.scene.empty())
+            particleManager.init(_options.particles);
+        else
+        {
+            // Reading and building the scene are timed apart from the run
+            auto start = Clock::now();
+            Scene scene;
+            string error;
+            if (!scene.load(_options.scene, error))
+            {
+                cout << "cannot load " << _options.scene << ", " << error << endl;
+                return 1;
+            }
+            double parsing = seconds(start);
+
+            start = Clock::now();
+            particleManager.loadScene(scene);
+            cout << "scene: read in " << parsing * 1000 << " ms, built in " << seconds(start) * 1000 << " ms" << endl;
+        }
+
+        SoftwareRenderer renderer;
+        double simulation = 0, rasterization = 0, writing = 0;
+        uint images = 0;
+
+        // A GIF is <output>.gif, a PNG sequence <output>_<image>.png
+        FrameRecorder recorder;
+        if (_options.record == "gif" && !recorder.start(FrameRecorder::Format::Gif, _options.output + ".gif"))
+            return 1;
+        if (_options.record == "png")
+            recorder.start(FrameRecorder::Format::Png, _options.output);
+
+        for (uint frame{}; frame < _options.frames; ++frame)
+        {
+            auto start = Clock::now();
+            particleManager.update(FRAME_TIME);
+            simulation += seconds(start);
+
+            if (_options.every == 0 || frame % _options.every != 0)
+                continue;
+
+            // The cost of an image is kept apart from the simulation
+            start = Clock::now();
+            renderer.clear(Color{ 220, 220, 220, 255 }); // background of GameSPH
+            particleManager.render(renderer);
+            rasterization += seconds(start);
+
+            start = Clock::now();
+            // Stamped with the time of the run, so a GIF plays at its speed
+            if (recorder.isRecording())
+                recorder.submit(renderer.copy(), frame * FRAME_TIME);
+            else
+            {
+                char fileName[512];
+                snprintf(fileName, sizeof(fileName), "%s_%05u.%s", _options.output.c_str(), frame, _options.format.c_str());
+
+                if (!renderer.save(fileName))
+                {
+                    cout << "cannot write " << fileName << endl;
+                    return 1;
+                }
+            }
+            writing += seconds(start);
+            ++images;
+        }
+
+        // Waits for the encoder, its time is in the writing
+        auto start = Clock::now();
+        recorder.stop();
+        writing += seconds(start);
+
+        cout << _options.frames << " frames: simulation " << simulation * 1000 / max(_options.frames, 1u) << " ms/frame" << endl;
+        if (images > 0)
+            cout << images << " images: rasterization " << rasterization * 1000 / images << " ms, writing "
+                 << writing * 1000 / images << " ms per image" << endl;
+
+        return 0;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Runs the 2D simulation without a window, for machines with no display or GPU.
+// Every few frames the view is drawn by the software renderer and written to an image.
+//
+//   fluid_simulation --headless [--particles 2000 [--settled] | --scene file] [--frames 300] [--every 30]
+//                    [--output frame] [--format png|qoi] [--record gif|png] [--view particles|cells]
+
+#include <string>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    struct HeadlessOptions
+    {
+        ulong particles = 2000;
+        bool settled = false;         // the particles start at rest, see ParticleManager::initSettled
+        std::string scene;            // instead of the particles, see Scene.h
+        uint frames = 300;
+        uint every = 30;              // frames between two images, 0 for none
+        std::string output = "frame"; // images are <output>_<frame>.<format>
+        std::string format = "png";
+        std::string record;           // gif or png: the images go through a FrameRecorder instead, see FrameRecorder.h
+        uchar view = 1 << 0;          // Render mask of ParticleManager
+
+        // false on an unknown or incomplete option
+        bool parse(int argc, char** argv);
+    };
+
+    class HeadlessRun
+    {
+        inline static const float FRAME_TIME = 1.0f / 30; // as GameSPH at its target FPS
+
+    public:
+        explicit HeadlessRun(const HeadlessOptions&);
+
+        // Returns the exit code of the program
+        int run();
+
+    private:
+        HeadlessOptions _options;
+    };
+}
@@ -0,0 +1,32 @@
+#include "HilbertCurve.h"
+
+#include <utility>
+
+namespace SPH
+{
+    uint hilbertIndex(uint order, uint x, uint y)
+    {
+        uint side = 1u << order;
+        uint index = 0;
+
+        // From the largest quadrants down, each one turned so the curve enters it where the last one left
+        for (uint half{ side / 2 }; half > 0; half /= 2)
+        {
+            uint right = (x & half) > 0;
+            uint bottom = (y & half) > 0;
+            index += half * half * ((3 * right) ^ bottom);
+
+            if (bottom == 0)
+            {
+                if (right == 1)
+                {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+
+        return index;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Position of a cell along a Hilbert curve, which visits every cell of a square
+// of 2^order cells of side once, going from a cell to a touching one.
+// Consecutive positions stay close in space, so a run of positions is a compact region.
+
+#include "Globals.h"
+
+namespace SPH
+{
+    uint hilbertIndex(uint order, uint x, uint y);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cmath>
+#include <raylib.h>
+
+namespace SPH
+{
+    // Normalisation of the smoothing kernels defined in Müller and their gradients
+    template <int DIM>
+    struct Kernels;
+
+    // The 2D scenes were tuned with these values, keep them so they behave the same
+    template <>
+    struct Kernels<2>
+    {
+        static double poly6(double h) { return 315.0 / (65.0 * PI * pow(h, 9.0)); }
+        static double spikyGrad(double h) { return -45.0 / (PI * pow(h, 6.0)); }
+        static double viscLap(double h) { return 45.0 / (PI * pow(h, 6.0)); }
+        // The volume value of Akinci, kept as a tuning value: SURFACE_TENSION was tuned with it.
+        // The spline with the plane integral of the volume one would be 25280 / (627 PI h^8).
+        static double cohesion(double h) { return 32.0 / (PI * pow(h, 9.0)); }
+    };
+
+    template <>
+    struct Kernels<3>
+    {
+        static double poly6(double h) { return 315.0 / (64.0 * PI * pow(h, 9.0)); }
+        static double spikyGrad(double h) { return -45.0 / (PI * pow(h, 6.0)); }
+        static double viscLap(double h) { return 45.0 / (PI * pow(h, 6.0)); }
+        static double cohesion(double h) { return 32.0 / (PI * pow(h, 9.0)); } // spline of Akinci et al. 2013
+    };
+}
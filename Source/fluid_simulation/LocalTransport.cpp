@@ -0,0 +1,45 @@
+#include "LocalTransport.h"
+
+namespace SPH
+{
+    LocalTransport::Hub::Hub(uint ranks)
+        : _ranks(ranks)
+        , _queues(ranks * ranks)
+    {}
+
+    LocalTransport::LocalTransport(Hub& hub, uint rank)
+        : _hub(hub)
+        , _rank(rank)
+    {}
+
+    uint LocalTransport::rank() const
+    {
+        return _rank;
+    }
+
+    uint LocalTransport::size() const
+    {
+        return _hub._ranks;
+    }
+
+    void LocalTransport::send(uint to, const Bytes& message)
+    {
+        Hub::Queue& queue = _hub._queues[_rank * _hub._ranks + to];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.messages.push_back(message);
+        }
+        queue.ready.notify_one();
+    }
+
+    Transport::Bytes LocalTransport::receive(uint from)
+    {
+        Hub::Queue& queue = _hub._queues[from * _hub._ranks + _rank];
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.ready.wait(lock, [&] { return !queue.messages.empty(); });
+
+        Bytes message = std::move(queue.messages.front());
+        queue.messages.pop_front();
+        return message;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Ranks running as threads of one process, the messages are moved through shared queues.
+// The transport of the platforms without Unix domain sockets, and the quickest to debug.
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Transport.h"
+
+namespace SPH
+{
+    class LocalTransport final : public Transport
+    {
+    public:
+        // The queues of every pair of ranks, shared by their transports
+        class Hub
+        {
+        public:
+            explicit Hub(uint ranks);
+
+        private:
+            friend class LocalTransport;
+
+            struct Queue
+            {
+                std::mutex mutex;
+                std::condition_variable ready;
+                std::deque<Bytes> messages;
+            };
+
+            uint _ranks;
+            std::vector<Queue> _queues; // from * ranks + to
+        };
+
+        LocalTransport(Hub&, uint rank);
+
+        uint rank() const override;
+        uint size() const override;
+        void send(uint to, const Bytes&) override;
+        Bytes receive(uint from) override;
+
+    private:
+        Hub& _hub;
+        uint _rank;
+    };
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <raylib.h>
+
+namespace SPH
+{
+    // Properties of one of the fluids of a mixture
+    struct Material
+    {
+        const char* name;
+        double mass;
+        double restDensity;
+        double viscosity;
+        Color color;
+    };
+}
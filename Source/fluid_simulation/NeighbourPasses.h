@@ -0,0 +1,210 @@
+#pragma once
+
+// The passes over the neighbours shared by the 2D and 3D simulations: the grid cells handed to
+// the workers in blocks weighted by their neighbour pairs, the walk over the neighbours of a
+// particle, and the terms both solvers have, pressure, viscosity, integration and walls.
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "Globals.h"
+#include "Particle.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+
+namespace SPH
+{
+    template <int DIM>
+    class NeighbourPasses
+    {
+        using cint = const int;
+        using Shape = GridShape<DIM>;
+        using Grid = BasicSpatialGrid<DIM>;
+        using Point = BasicParticle<DIM>;
+
+    public:
+        inline static cint CELLS_PER_TASK = 4; // cells of a grid row handled by one scheduler task
+
+        using Vector = std::array<double, DIM>;
+
+        // Blocks of CELLS_PER_TASK cells of a row. The empty cells and the ones set in asleep are left
+        // out, asleep may be empty. Settled fluid leaves most cells empty and a few very dense ones,
+        // so a block costs about its particles times their neighbour candidates.
+        void build(const Grid& grid, const std::vector<uchar>& asleep)
+        {
+            _cells.clear();
+            _taskStart.assign(1, 0);
+            _taskWeights.clear();
+
+            // The cell ids of a row are consecutive in 2D and 3D
+            for (uint row{}; row < Shape::NB_CELLS / Shape::ROW_SIZE; ++row)
+                for (uint x0{}; x0 < Shape::ROW_SIZE; x0 += CELLS_PER_TASK)
+                {
+                    uint weight = 0;
+                    for (uint x{ x0 }; x < x0 + CELLS_PER_TASK && x < Shape::ROW_SIZE; ++x)
+                    {
+                        uint id = row * Shape::ROW_SIZE + x;
+                        if (uint nb = grid.count(id); nb && (asleep.empty() || !asleep[id]))
+                        {
+                            _cells.push_back(id);
+                            weight += nb * stencilCount(grid, id);
+                        }
+                    }
+
+                    if (weight > 0)
+                    {
+                        _taskStart.push_back(static_cast<uint>(_cells.size()));
+                        _taskWeights.push_back(weight);
+                    }
+                }
+        }
+
+        // Runs f(i, worker) for the particles of the blocks, the blocks are shared by the workers
+        template <typename F>
+        void run(ThreadPool& workers, const Grid& grid, F&& f) const
+        {
+            workers.runTasks(_taskWeights, [&](uint task, uint worker)
+            {
+                for (uint k{ _taskStart[task] }; k < _taskStart[task + 1]; ++k)
+                    for (uint i : grid.cell(_cells[k]))
+                        f(i, worker);
+            });
+        }
+
+        // Particles in the cells around the cell, the candidates of a neighbour search
+        static uint stencilCount(const Grid& grid, uint id)
+        {
+            uint x = id % Shape::ROW_SIZE;
+            uint row = id / Shape::ROW_SIZE;
+            if constexpr (DIM == 2)
+                return grid.stencilCount(x, row);
+            else
+                return grid.stencilCount(x, row % Shape::COL_SIZE, row / Shape::COL_SIZE);
+        }
+
+        // Calls f with the id of the cells around p
+        template <typename F>
+        static void forEachNeighbourCell(const Point& p, F&& f)
+        {
+            if constexpr (DIM == 2)
+                Shape::forEachNeighbourCell(Shape::refX(p), Shape::refY(p), f);
+            else
+                Shape::forEachNeighbourCell(Shape::refX(p), Shape::refY(p), Shape::refZ(p), f);
+        }
+
+        // Calls f(j, pj, d, rSq) for the particles j of the cell near closer than the kernel radius
+        // to pi, pi itself included, with d from pi to pj and rSq its squared length
+        template <typename F>
+        static void forEachInCell(const Grid& grid, const std::vector<Point>& particles, uint near,
+                                  const Point& pi, double hsq, F&& f)
+        {
+            Vector origin = position(pi);
+
+            for (uint j : grid.cell(near))
+            {
+                const Point& pj = particles[j];
+                Vector d = position(pj);
+                double rSq = 0;
+                for (int k{}; k < DIM; ++k)
+                {
+                    d[k] -= origin[k];
+                    rSq += d[k] * d[k];
+                }
+
+                if (rSq < hsq)
+                    f(j, pj, d, rSq);
+            }
+        }
+
+        // forEachInCell over all the cells around pi
+        template <typename F>
+        static void forEachNeighbour(const Grid& grid, const std::vector<Point>& particles,
+                                     const Point& pi, double hsq, F&& f)
+        {
+            forEachNeighbourCell(pi, [&](uint near) { forEachInCell(grid, particles, near, pi, hsq, f); });
+        }
+
+        // Pressure and viscosity of pj on pi, added to the sums, with d and r from pi to pj
+        static void addPressureViscosity(const Point& pi, const Point& pj, const Vector& d, double r, double h,
+                                         double massSpikyGrad, double massViscLap, Vector& pressure, Vector& viscosity)
+        {
+            double tmpProcess = h - r;
+            double fpress = massSpikyGrad * (pi.p + pj.p) / (2.0 * pj.rho) * tmpProcess * tmpProcess;
+            Vector vi = velocity(pi);
+            Vector vj = velocity(pj);
+
+            for (int k{}; k < DIM; ++k)
+            {
+                pressure[k] += -d[k] / r * fpress;
+                viscosity[k] += massViscLap * (vj[k] - vi[k]) / pj.rho * tmpProcess;
+            }
+        }
+
+        // Velocity kicked by the forces, kept when they are not numbers, then position drifted
+        static void kickDrift(Point& p, double kick, double dt)
+        {
+            bool finite = p.fx == p.fx && p.fy == p.fy;
+            if constexpr (DIM == 3)
+                finite = finite && p.fz == p.fz;
+
+            if (p.rho != 0 && finite)
+            {
+                p.vx += kick*p.fx/p.rho;
+                p.vy += kick*p.fy/p.rho;
+                if constexpr (DIM == 3)
+                    p.vz += kick*p.fz/p.rho;
+            }
+
+            p.x += dt*p.vx;
+            p.y += dt*p.vy;
+            if constexpr (DIM == 3)
+                p.z += dt*p.vz;
+        }
+
+        // Keeps p inside the screen, and the depth in 3D, damping its velocity on a wall
+        static void enforceWalls(Point& p, double radius, double damping)
+        {
+            wall(p.x, p.vx, radius, SCREEN_WIDTH, damping);
+            wall(p.y, p.vy, radius, SCREEN_HEIGHT, damping);
+            if constexpr (DIM == 3)
+                wall(p.z, p.vz, radius, SCREEN_DEPTH, damping);
+        }
+
+    private:
+        static Vector position(const Point& p)
+        {
+            if constexpr (DIM == 2)
+                return { p.x, p.y };
+            else
+                return { p.x, p.y, p.z };
+        }
+
+        static Vector velocity(const Point& p)
+        {
+            if constexpr (DIM == 2)
+                return { p.vx, p.vy };
+            else
+                return { p.vx, p.vy, p.vz };
+        }
+
+        static void wall(double& x, double& v, double radius, double size, double damping)
+        {
+            if (x - radius < 0.0f)
+            {
+                v *= damping;
+                x = radius;
+            }
+
+            if (x + radius > size)
+            {
+                v *= damping;
+                x = size - radius;
+            }
+        }
+
+        std::vector<uint> _cells;       // with particles and awake, block after block
+        std::vector<uint> _taskStart;   // of each block in _cells, then the end of the last one
+        std::vector<uint> _taskWeights; // neighbour pairs of each block
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+namespace SPH
+{
+    // Particle data structure, for a 2D or 3D simulation
+    template <int DIM>
+    struct BasicParticle;
+
+    template <>
+    struct BasicParticle<2>
+    {
+        BasicParticle() = default;
+        BasicParticle(double, double);
+        double x, y;   // Position
+        double vx, vy; // Velocity
+        double fx, fy; // Total forces
+        double rho;    // Density
+        double p;      // Pressure
+        unsigned char material; // Index in the material table
+        unsigned int id;        // Given when spawned or first touched by a brush, 0 before
+    };
+
+    template <>
+    struct BasicParticle<3>
+    {
+        BasicParticle() = default;
+        BasicParticle(double, double, double);
+        double x, y, z;    // Position
+        double vx, vy, vz; // Velocity
+        double fx, fy, fz; // Total forces
+        double rho;        // Density
+        double p;          // Pressure
+    };
+
+    using Particle = BasicParticle<2>;
+    using Particle3D = BasicParticle<3>;
+}
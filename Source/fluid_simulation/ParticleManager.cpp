@@ -1,5 +1,11 @@
 #include "ParticleManager.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
 #include <raylib.h>
 #include <Code_Utilities_Light_v2.h>
 
@@ -7,30 +13,65 @@
 
 using namespace SPH;
 
-Particle::Particle(double px, double py) 
+Particle::BasicParticle(double px, double py)
     : x(px), y(py)
     , vx{}, vy{}
     , fx{}, fy{}
     , rho{}, p{}
+    , material{}
+    , id{}
 {}
 
-ParticleManager::ParticleManager()
+ParticleManager::ParticleManager(uint nbWorkers)
+    : _integrator(Integrator::SemiImplicitEuler)
+    , _lastStep(0)
+    , _colorMode(ColorMode::Material)
+    , _colorMin(0)
+    , _colorMax(0)
+    , _spawnMaterial(0)
+    , _nextId(1)
+    , _otherMaterial(0)
+    , _surfaceTension(false)
+    , _xsph(0)
+    , _artificialViscosity(0)
+    , _slowMotion(SLOW_MOTION)
+    , _obstaclePressure(false)
+    , _boundaryParticles(false)
+    , _brushCursor(0)
+    , _snapshot(std::make_shared<FluidSnapshot>())
+    , _densityStale(true)
+    , _lod(false)
+    , _workers(nbWorkers)
+    , _workerBusy(_workers.size())
+    , _steals(0)
+    , _sleeping(false)
+    , _sleepSpeedSq(0)
+    , _cellCalmSteps(NB_CELLS)
+    , _cellMoving(NB_CELLS)
+    , _cellAsleep(NB_CELLS)
 {
     _ax = 0;
     _ay = GRAVITY;
 
     _renderMode = (uchar)Render::Particles;
     BdB::srandInt((uint)time(0));
+
+    for (const Material& m : MATERIALS)
+        _materialMass.push_back(m.mass);
 }
 
 void ParticleManager::init(ulong n)
 {
     cout << "Init with " << n << " particles" << endl;
 
+    wakeAll();
     _particles.clear();
     _particles.reserve(n);
+    _otherMaterial = 0;
+    _lastStep = 0;
 
-    while (_particles.size() < n)
+    // Obstacles may cover most of the disc, give up after a while
+    for (ulong tries{}; _particles.size() < n && tries < n * 1000; ++tries)
     {
         double x = BdB::randInt(SCREEN_WIDTH);
         double y = BdB::randInt(SCREEN_HEIGHT);
@@ -40,13 +81,295 @@ void ParticleManager::init(ulong n)
         double centerDistSqrt = tmpX * tmpX + tmpY * tmpY;
 
         double tmpRef = fmin(SCREEN_WIDTH, SCREEN_HEIGHT) * 0.25;
-        if (centerDistSqrt < tmpRef * tmpRef)
+        if (centerDistSqrt < tmpRef * tmpRef && _obstacles.distance(x, y) > PARTICLE_RADIUS)
             _particles.push_back(Particle(x, y));
     }
 }
 
+bool ParticleManager::initSettled(ulong n)
+{
+    cout << "Init with " << n << " settled particles" << endl;
+
+    uint64_t key = settledKey(n);
+    std::ostringstream fileName;
+    fileName << SETTLED_CACHE << "/settled_" << std::hex << key << ".bin";
+
+    bool cached = true;
+    auto found = _settledCache.find(key);
+    if (found != _settledCache.end())
+    {
+        _particles = found->second;
+        _otherMaterial = 0;
+    }
+    else if (readSettled(fileName.str(), n))
+        _settledCache[key] = _particles;
+    else
+    {
+        cached = false;
+        packLattice(n);
+        relax();
+        _settledCache[key] = _particles;
+        writeSettled(fileName.str());
+    }
+
+    wakeAll();
+    _lastStep = 0;
+    return cached;
+}
+
+void ParticleManager::initSettledUncached(ulong n)
+{
+    cout << "Init with " << n << " settled particles, not cached" << endl;
+
+    packLattice(n);
+    relax();
+
+    wakeAll();
+    _lastStep = 0;
+}
+
+uint64_t ParticleManager::settledKey(ulong n) const
+{
+    // FNV-1a over everything the relaxation depends on
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](auto value)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        for (size_t i{}; i < sizeof(value); ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    };
+
+    add(SETTLED_VERSION);
+    add(static_cast<uint64_t>(n));
+    add(_ax);
+    add(_ay);
+    add(_boundaryParticles);
+    add(_obstaclePressure);
+    add(_surfaceTension);
+    add(_xsph);
+    add(_artificialViscosity);
+    add(_integrator);
+    add(_sleeping);
+    add(_obstacles.fingerprint());
+    return hash;
+}
+
+void ParticleManager::packLattice(ulong n)
+{
+    _particles.clear();
+    _particles.reserve(n);
+    _otherMaterial = 0;
+
+    // Hexagonal rows from the wall gravity points to: u along it, v away from it
+    bool vertical = _ax == 0;
+    double length = vertical ? SCREEN_WIDTH : SCREEN_HEIGHT;
+    double depth = vertical ? SCREEN_HEIGHT : SCREEN_WIDTH;
+    cdouble s = LATTICE_SPACING;
+
+    for (uint row{}; _particles.size() < n; ++row)
+    {
+        double v = s * 0.5 + row * s * 0.866;
+        if (v > depth)
+            break;
+
+        for (double u{ s * 0.5 + (row % 2) * s * 0.5 }; u < length && _particles.size() < n; u += s)
+        {
+            double x, y;
+            if (_ay > 0)      { x = u; y = SCREEN_HEIGHT - v; }
+            else if (_ay < 0) { x = u; y = v; }
+            else if (_ax > 0) { x = SCREEN_WIDTH - v; y = u; }
+            else              { x = v; y = u; }
+
+            if (_obstacles.distance(x, y) > PARTICLE_RADIUS)
+                _particles.push_back(Particle(x, y));
+        }
+    }
+}
+
+void ParticleManager::relax()
+{
+    // Nothing comes in or goes out meanwhile
+    std::vector<Emitter> emitters;
+    std::vector<Sink> sinks;
+    std::swap(emitters, _emitters);
+    std::swap(sinks, _sinks);
+    float slowMotion = _slowMotion;
+    _slowMotion = RELAX_SLOW_MOTION;
+
+    for (uint step{}; step < RELAX_STEPS; ++step)
+    {
+        update(1.0f / 30);
+        for (Particle& p : _particles)
+        {
+            p.vx *= RELAX_DAMPING;
+            p.vy *= RELAX_DAMPING;
+        }
+    }
+
+    for (Particle& p : _particles)
+        p.vx = p.vy = 0;
+
+    _slowMotion = slowMotion;
+    std::swap(emitters, _emitters);
+    std::swap(sinks, _sinks);
+}
+
+bool ParticleManager::readSettled(const std::string& fileName, ulong n)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    uint64_t count = 0;
+    if (!file.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > n)
+        return false;
+
+    std::vector<double> positions(2 * count);
+    if (!file.read(reinterpret_cast<char*>(positions.data()), positions.size() * sizeof(double)))
+        return false;
+
+    _particles.clear();
+    for (uint64_t i{}; i < count; ++i)
+        _particles.push_back(Particle(positions[2 * i], positions[2 * i + 1]));
+    _otherMaterial = 0;
+    return true;
+}
+
+void ParticleManager::writeSettled(const std::string& fileName) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(SETTLED_CACHE, error);
+
+    std::vector<double> positions;
+    positions.reserve(2 * _particles.size());
+    for (const Particle& p : _particles)
+    {
+        positions.push_back(p.x);
+        positions.push_back(p.y);
+    }
+
+    // Only the cache in memory is kept if the file cannot be written
+    std::ofstream file(fileName, std::ios::binary);
+    uint64_t count = _particles.size();
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(double));
+}
+
+bool ParticleManager::loadScene(const Scene& scene)
+{
+    BdB::srandInt(static_cast<int>(scene.seed));
+
+    // What the scene does not declare takes the value of a new simulation, not the one the keys left
+    setGravity(scene.gravity.value_or(DOWN));
+    setIntegrator(scene.leapfrog.value_or(false) ? Integrator::Leapfrog : Integrator::SemiImplicitEuler);
+    setXsph(scene.xsph.value_or(0));
+    setArtificialViscosity(scene.viscosity.value_or(0));
+    setSlowMotion(scene.slowMotion.value_or(SLOW_MOTION));
+    setSurfaceTension(scene.tension.value_or(false));
+    setBoundaryParticles(scene.boundary.value_or(false));
+    setObstaclePressure(scene.obstaclePressure.value_or(false));
+    setSleeping(scene.sleeping.value_or(false));
+
+    clearEmitters();
+    _emitters = scene.emitters;
+    _sinks = scene.sinks;
+
+    // A domain smaller than the screen is closed by obstacles over the rest
+    std::ostringstream obstacles;
+    obstacles << scene.obstacles;
+    if (scene.width < SCREEN_WIDTH)
+        obstacles << "box " << scene.width << " 0 " << SCREEN_WIDTH + H << " " << SCREEN_HEIGHT + H << "\n";
+    if (scene.height < SCREEN_HEIGHT)
+        obstacles << "box 0 " << scene.height << " " << SCREEN_WIDTH + H << " " << SCREEN_HEIGHT + H << "\n";
+
+    bool valid = true;
+    if (obstacles.str().empty())
+        clearObstacles();
+    else
+        valid = loadObstacles(obstacles.str());
+
+    wakeAll();
+    _lastStep = 0;
+    fillBlocks(scene);
+
+    cout << "Scene with " << _particles.size() << " particles" << endl;
+    return valid;
+}
+
+namespace
+{
+    // Uniform in [-0.5, 0.5), from the seed and the lattice site only (splitmix64)
+    double jitterOf(uint64_t seed, uint64_t site)
+    {
+        uint64_t z = seed + site * 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        return static_cast<double>(z >> 11) / 9007199254740992.0 - 0.5;
+    }
+}
+
+void ParticleManager::fillBlocks(const Scene& scene)
+{
+    struct Row
+    {
+        const Scene::Block* block;
+        double y;
+        size_t first; // lattice site of the start of the row
+        uint count;
+    };
+
+    std::vector<Row> rows;
+    size_t sites = 0;
+    for (const Scene::Block& block : scene.blocks)
+    {
+        uint columns = static_cast<uint>(std::max(0.0, floor((block.right - block.left) / block.spacing) + 1));
+        for (double y{ block.top }; y <= block.bottom; y += block.spacing)
+        {
+            rows.push_back({ &block, y, sites, columns });
+            sites += columns;
+        }
+    }
+
+    // Every site gets a slot, the ones in a wall or an obstacle are taken out after
+    _particles.assign(sites, Particle(0, 0));
+    std::vector<uchar> kept(sites);
+
+    _workers.parallelFor(static_cast<uint>(rows.size()), [&](uint begin, uint end, uint)
+    {
+        for (uint r{ begin }; r < end; ++r)
+        {
+            const Row& row = rows[r];
+            const Scene::Block& block = *row.block;
+
+            for (uint k{}; k < row.count; ++k)
+            {
+                size_t site = row.first + k;
+                double x = block.left + k * block.spacing + jitterOf(scene.seed, 2 * site) * block.jitter * block.spacing;
+                double y = row.y + jitterOf(scene.seed, 2 * site + 1) * block.jitter * block.spacing;
+
+                if (x < 0 || x > scene.width || y < 0 || y > scene.height || _obstacles.distance(x, y) <= PARTICLE_RADIUS)
+                    continue;
+
+                Particle& p = _particles[site];
+                p.x = x;
+                p.y = y;
+                p.material = block.material;
+                kept[site] = true;
+            }
+        }
+    });
+
+    size_t nb = 0;
+    for (size_t site{}; site < sites; ++site)
+        if (kept[site])
+            _particles[nb++] = _particles[site];
+    _particles.resize(nb);
+    countMaterials();
+}
+
 int ParticleManager::addBlock(int center_x, int center_y)
 {
+    wakeRect(center_x - SCREEN_WIDTH * 0.08f, center_y - SCREEN_HEIGHT * 0.08f,
+             center_x + SCREEN_WIDTH * 0.08f + H, center_y + SCREEN_HEIGHT * 0.08f + H);
+
     int particleAdded = 0;
     for (int i=0; i<=4; ++i) 
         for (int j=0; j<=4; ++j)
@@ -54,9 +377,9 @@ int ParticleManager::addBlock(int center_x, int center_y)
             double x = center_x + (j - 2) * SCREEN_WIDTH * 0.04f + BdB::randInt((int)H);
             double y = center_y + (i - 2) * SCREEN_HEIGHT * 0.04f + BdB::randInt((int)H);
 
-            if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT)
+            if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT && _obstacles.distance(x, y) > PARTICLE_RADIUS)
             {
-                _particles.push_back(Particle(x, y));
+                _particles.push_back(spawn(x, y));
                 ++particleAdded;
             }
         }
@@ -84,23 +407,28 @@ void ParticleManager::setDefaultColor()
 
 void ParticleManager::removeParticles(uint nb)
 {
+    wakeAll();
+
     size_t currentSize = _particles.size();
-    if (currentSize > nb)
-        _particles.resize(currentSize - nb);
-    else
-        _particles.clear();
+    size_t kept = currentSize > nb ? currentSize - nb : 0;
+    for (size_t i{ kept }; i < currentSize; ++i)
+        _otherMaterial -= _particles[i].material != 0;
+    _particles.resize(kept);
 
     cout << _particles.size() << " particles" << endl;
 }
 
 void ParticleManager::addOne(int x, int y)
 {
-    _particles.push_back(Particle(x, y));
+    wakeRect(x, y, x, y);
+    _particles.push_back(spawn(x, y));
     cout << _particles.size() << " particles" << endl;
 }
 
 void ParticleManager::setGravity(int direction)
 {
+    wakeAll();
+
     switch (direction) 
     {
     case DOWN:
@@ -115,6 +443,10 @@ void ParticleManager::setGravity(int direction)
         _ax = +GRAVITY;
         _ay = 0;
         break;
+    case NO_GRAVITY:
+        _ax = 0;
+        _ay = 0;
+        break;
     default:
         _ax = -GRAVITY;
         _ay = 0;
@@ -123,6 +455,9 @@ void ParticleManager::setGravity(int direction)
 
 void ParticleManager::explode() 
 {
+    wakeAll();
+    _lastStep = 0;
+
     for (auto &p : _particles) 
     {
         p.vx = BdB::randInt(-5000, 5000);
@@ -130,186 +465,982 @@ void ParticleManager::explode()
     }
 }
 
-void SPH::ParticleManager::clearGrid()
+void SPH::ParticleManager::feedGrid()
 {
-    for (ColumnList& col: _grid)
-        for (RefList& entry: col)
-            entry.clear();
+    _grid.build(_particles, _workers);
 }
 
-void SPH::ParticleManager::feedGrid()
+GridBackend ParticleManager::getGridBackend() const
 {
-    clearGrid();
+    return _grid.getBackend();
+}
 
-    for (Particle& p : _particles)
-        _grid[refX(p)][refY(p)].push_back(&p);
+void ParticleManager::setGridBackend(GridBackend backend)
+{
+    _grid.setBackend(backend);
 }
 
-uint SPH::ParticleManager::refX(const Particle& p)
+Integrator ParticleManager::getIntegrator() const
 {
-    return (static_cast<uint>(p.x) >> BDH) % (ROW_SIZE);
+    return _integrator;
 }
 
-uint SPH::ParticleManager::refY(const Particle& p)
+void ParticleManager::setIntegrator(Integrator integrator)
 {
-    return (static_cast<uint>(p.y) >> BDH) % (COL_SIZE);
+    _integrator = integrator;
+    _lastStep = 0;
 }
 
-void ParticleManager::integrate(double dt)
+ColorMode ParticleManager::getColorMode() const
+{
+    return _colorMode;
+}
+
+void ParticleManager::setColorMode(ColorMode mode)
+{
+    _colorMode = mode;
+    _particleColors.clear();
+
+    // The first step sets the range
+    _colorMin = 1e300;
+    _colorMax = -1e300;
+}
+
+const std::vector<double>& ParticleManager::getWorkerBusyTimes() const
+{
+    return _workerBusy;
+}
+
+uint ParticleManager::getStealCount() const
+{
+    return _steals;
+}
+
+const std::vector<Particle>& ParticleManager::getParticles() const
+{
+    return _particles;
+}
+
+void ParticleManager::setParticles(std::vector<Particle> particles)
+{
+    _particles = std::move(particles);
+    countMaterials();
+}
+
+void ParticleManager::countMaterials()
+{
+    _otherMaterial = std::count_if(_particles.begin(), _particles.end(), [](const Particle& p) { return p.material != 0; });
+}
+
+uint ParticleManager::getCellPairs(uint cell) const
+{
+    return _grid.count(cell) * Passes::stencilCount(_grid, cell);
+}
+
+const PhaseTimers& ParticleManager::getPhaseTimers() const
+{
+    return _timers;
+}
+
+bool ParticleManager::isLodActive() const
+{
+    return _lod;
+}
+
+bool ParticleManager::loadObstacles(const std::string& description)
+{
+    wakeAll();
+    bool valid = _obstacles.loadShapes(description);
+    rebuildBoundary();
+    return valid;
+}
+
+bool ParticleManager::loadObstacleMask(const std::string& fileName)
+{
+    wakeAll();
+    bool loaded = _obstacles.loadMask(fileName);
+    rebuildBoundary();
+    return loaded;
+}
+
+void ParticleManager::clearObstacles()
+{
+    wakeAll();
+    _obstacles.clear();
+    rebuildBoundary();
+}
+
+bool ParticleManager::hasObstacles() const
+{
+    return !_obstacles.isEmpty();
+}
+
+bool ParticleManager::getObstaclePressure() const
+{
+    return _obstaclePressure;
+}
+
+void ParticleManager::setObstaclePressure(bool pressure)
+{
+    _obstaclePressure = pressure;
+}
+
+bool ParticleManager::getBoundaryParticles() const
+{
+    return _boundaryParticles;
+}
+
+void ParticleManager::setBoundaryParticles(bool boundary)
+{
+    wakeAll();
+    _boundaryParticles = boundary;
+    rebuildBoundary();
+}
+
+void ParticleManager::rebuildBoundary()
 {
-    for (auto &p : _particles)
+    // Sorted once here, the boundaries never move between two changes
+    if (_boundaryParticles)
+        _boundary.build(_obstacles);
+}
+
+std::shared_ptr<const FluidSnapshot> ParticleManager::getSnapshot() const
+{
+    return std::atomic_load(&_snapshot);
+}
+
+void ParticleManager::publishSnapshot()
+{
+    std::shared_ptr<FluidSnapshot> next = _spareSnapshot;
+    if (!next || next.use_count() > 1)
+        next = std::make_shared<FluidSnapshot>();
+
+    // The grid was just built from these positions
+    next->capture(_particles, _grid, _materialMass);
+    _spareSnapshot = std::atomic_exchange(&_snapshot, next);
+    _densityStale = true;
+}
+
+void ParticleManager::addBrushStroke(double x, double y, double strength, const std::shared_ptr<BrushRecord>& record)
+{
+    _brushStrokes.push_back({ x, y, strength, record });
+}
+
+void ParticleManager::undoBrush(const std::shared_ptr<BrushRecord>& record)
+{
+    _brushStrokes.erase(std::remove_if(_brushStrokes.begin() + _brushCursor, _brushStrokes.end(),
+                                       [&](const BrushStroke& b) { return b.record == record; }),
+                        _brushStrokes.end());
+    if (_brushCursor == _brushStrokes.size())
     {
-        // forward Euler integration
-        if (p.rho != 0 && p.fx == p.fx && p.fy == p.fy) 
+        _brushStrokes.clear();
+        _brushCursor = 0;
+    }
+
+    if (record->touches.empty())
+        return;
+
+    // The particles moved a little since the grid was built, and the sinks may have moved
+    // some of them to other indices: the ids tell which ones the stroke touched
+    double left = record->left - H, top = record->top - H;
+    double right = record->right + H, bottom = record->bottom + H;
+    auto byId = [](const BrushTouch& t, uint id) { return t.id < id; };
+
+    forEachInCells(left, top, right, bottom, [&](uint i)
+    {
+        if (i >= _particles.size() || _particles[i].id == 0)
+            return;
+
+        Particle& p = _particles[i];
+        auto t = std::lower_bound(record->touches.begin(), record->touches.end(), p.id, byId);
+        if (t != record->touches.end() && t->id == p.id)
         {
-            p.vx += dt*p.fx/p.rho;
-            p.vy += dt*p.fy/p.rho;
+            p.vx -= t->vx;
+            p.vy -= t->vy;
         }
+    });
+
+    wakeRect(left, top, right, bottom);
+}
 
-        p.x += dt*p.vx;
-        p.y += dt*p.vy;
+template <typename F>
+void ParticleManager::forEachInCells(double left, double top, double right, double bottom, F&& f)
+{
+    int x0 = std::max(static_cast<int>(left) / CEll_SIZE, 0);
+    int y0 = std::max(static_cast<int>(top) / CEll_SIZE, 0);
+    int x1 = std::min(static_cast<int>(right) / CEll_SIZE, ROW_SIZE - 1);
+    int y1 = std::min(static_cast<int>(bottom) / CEll_SIZE, COL_SIZE - 1);
+
+    for (int y{ y0 }; y <= y1; ++y)
+        for (int x{ x0 }; x <= x1; ++x)
+            for (uint i : _grid.cell(Shape::cellId(x, y)))
+                f(i);
+}
+
+void ParticleManager::applyBrushes()
+{
+    if (_brushCursor == _brushStrokes.size())
+        return;
 
-        // enforce boundary conditions
-        if (p.x - PARTICLE_RADIUS < 0.0f)
+    // One sample per step, so a stroke queued at once or while paused is replayed as it was drawn
+    const BrushStroke& b = _brushStrokes[_brushCursor++];
+    cdouble radiusSq = BRUSH_RADIUS * BRUSH_RADIUS;
+    _brushTouched.clear();
+
+    wakeRect(b.x - BRUSH_RADIUS, b.y - BRUSH_RADIUS, b.x + BRUSH_RADIUS, b.y + BRUSH_RADIUS);
+
+    // Only the cells under the brush, the grid was just built
+    forEachInCells(b.x - BRUSH_RADIUS, b.y - BRUSH_RADIUS, b.x + BRUSH_RADIUS, b.y + BRUSH_RADIUS, [&](uint i)
+    {
+        Particle& p = _particles[i];
+        double tmpX = p.x - b.x;
+        double tmpY = p.y - b.y;
+        double distSqrt = tmpX * tmpX + tmpY * tmpY;
+
+        if (distSqrt >= radiusSq || distSqrt == 0)
+            return;
+
+        // Strongest at the center, nothing on the edge
+        double dist = sqrt(distSqrt);
+        double impulse = BRUSH_IMPULSE * b.strength * (1.0 - dist / BRUSH_RADIUS) / dist;
+        p.vx += tmpX * impulse;
+        p.vy += tmpY * impulse;
+
+        // The particles of a scene are named when a brush first touches them
+        if (p.id == 0)
+            p.id = _nextId++;
+        _brushTouched.push_back({ p.id, tmpX * impulse, tmpY * impulse });
+    });
+
+    // The record sums what each sample gave a particle
+    BrushRecord& record = *b.record;
+    record.left = std::min(record.left, b.x - BRUSH_RADIUS);
+    record.top = std::min(record.top, b.y - BRUSH_RADIUS);
+    record.right = std::max(record.right, b.x + BRUSH_RADIUS);
+    record.bottom = std::max(record.bottom, b.y + BRUSH_RADIUS);
+
+    std::vector<BrushTouch>& touches = record.touches;
+    auto byId = [](const BrushTouch& a, const BrushTouch& b) { return a.id < b.id; };
+    size_t known = touches.size();
+    std::sort(_brushTouched.begin(), _brushTouched.end(), byId);
+    for (const BrushTouch& t : _brushTouched)
+    {
+        auto found = std::lower_bound(touches.begin(), touches.begin() + known, t, byId);
+        if (found != touches.begin() + known && found->id == t.id)
         {
-            p.vx *= BOUND_DAMPING;
-            p.x = PARTICLE_RADIUS;
+            found->vx += t.vx;
+            found->vy += t.vy;
         }
+        else
+            touches.push_back(t);
+    }
+    std::inplace_merge(touches.begin(), touches.begin() + known, touches.end(), byId);
+
+    if (_brushCursor == _brushStrokes.size())
+    {
+        _brushStrokes.clear();
+        _brushCursor = 0;
+    }
+}
+
+uchar ParticleManager::getSpawnMaterial() const
+{
+    return _spawnMaterial;
+}
+
+void ParticleManager::setSpawnMaterial(uchar material)
+{
+    _spawnMaterial = material % NB_MATERIALS;
+}
+
+Particle ParticleManager::spawn(double x, double y)
+{
+    Particle p(x, y);
+    p.material = _spawnMaterial;
+    p.id = _nextId++;
+    _otherMaterial += p.material != 0;
+    return p;
+}
+
+uint ParticleManager::getNextId() const
+{
+    return _nextId;
+}
+
+void ParticleManager::removeSpawned(uint first, uint last)
+{
+    wakeAll();
 
-        if (p.x + PARTICLE_RADIUS > SCREEN_WIDTH)
+    // Wherever the sinks moved them, and not the particles the emitters added since
+    for (uint i{}; i < _particles.size();)
+    {
+        if (_particles[i].id >= first && _particles[i].id < last)
+            removeAt(i);
+        else
+            ++i;
+    }
+
+    cout << _particles.size() << " particles" << endl;
+}
+
+void ParticleManager::addEmitter(double x, double y, double vx, double vy, double width, double rate)
+{
+    _emitters.push_back({ x, y, vx, vy, width, rate, 0 });
+    _particles.reserve(MAX_STREAMED);
+}
+
+void ParticleManager::addSink(double left, double top, double right, double bottom)
+{
+    _sinks.push_back({ left, top, right, bottom });
+}
+
+void ParticleManager::clearEmitters()
+{
+    _emitters.clear();
+    _sinks.clear();
+}
+
+bool ParticleManager::hasEmitters() const
+{
+    return !_emitters.empty() || !_sinks.empty();
+}
+
+void ParticleManager::removeAt(uint i)
+{
+    // The last particle fills the hole, the array stays packed and keeps its capacity.
+    // Its color follows it, unless it was added since the last integrate and has none yet
+    size_t last = _particles.size() - 1;
+    if (_colorMode != ColorMode::Material && i < _particleColors.size())
+        _particleColors[i] = last < _particleColors.size() ? _particleColors[last] : _color;
+
+    _otherMaterial -= _particles[i].material != 0;
+    _particles[i] = _particles.back();
+    _particles.pop_back();
+}
+
+void ParticleManager::drainSinks()
+{
+    for (const Sink& sink : _sinks)
+    {
+        size_t before = _particles.size();
+
+        for (uint i{}; i < _particles.size();)
         {
-            p.vx *= BOUND_DAMPING;
-            p.x = SCREEN_WIDTH - PARTICLE_RADIUS;
+            if (sink.contains(_particles[i].x, _particles[i].y))
+                removeAt(i);
+            else
+                ++i;
         }
 
-        if (p.y - PARTICLE_RADIUS < 0.0f)
+        // The fluid around the sink lost its neighbours
+        if (_particles.size() != before)
+            wakeRect(sink.left, sink.top, sink.right, sink.bottom);
+    }
+}
+
+void ParticleManager::feedEmitters(double dt)
+{
+    for (Emitter& e : _emitters)
+    {
+        e.pending += e.rate * dt;
+        int count = static_cast<int>(e.pending);
+        e.pending -= count;
+
+        double speed = sqrt(e.vx * e.vx + e.vy * e.vy);
+        if (count == 0 || speed == 0)
+            continue;
+
+        // Across the nozzle, and spread along the jet by the time elapsed since they left it
+        double nx = -e.vy / speed;
+        double ny = e.vx / speed;
+        int halfWidth = static_cast<int>(e.width * 0.5);
+
+        for (int k{}; k < count && _particles.size() < MAX_STREAMED; ++k)
         {
-            p.vy *= BOUND_DAMPING;
-            p.y = PARTICLE_RADIUS;
+            double across = BdB::randInt(-halfWidth, halfWidth);
+            double along = dt / _slowMotion * k / count;
+            double x = e.x + nx * across + e.vx * along;
+            double y = e.y + ny * across + e.vy * along;
+
+            if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT && _obstacles.distance(x, y) > PARTICLE_RADIUS)
+            {
+                Particle p = spawn(x, y);
+                p.vx = e.vx;
+                p.vy = e.vy;
+                _particles.push_back(p);
+            }
         }
 
-        if (p.y + PARTICLE_RADIUS > SCREEN_HEIGHT)
+        wakeRect(e.x - e.width, e.y - e.width, e.x + e.width, e.y + e.width);
+    }
+}
+
+bool ParticleManager::getSurfaceTension() const
+{
+    return _surfaceTension;
+}
+
+void ParticleManager::setSurfaceTension(bool tension)
+{
+    wakeAll();
+    _surfaceTension = tension;
+    if (!tension)
+        _normals = {};
+}
+
+double ParticleManager::getXsph() const
+{
+    return _xsph;
+}
+
+void ParticleManager::setXsph(double epsilon)
+{
+    _xsph = epsilon;
+}
+
+double ParticleManager::getArtificialViscosity() const
+{
+    return _artificialViscosity;
+}
+
+void ParticleManager::setArtificialViscosity(double alpha)
+{
+    _artificialViscosity = alpha;
+}
+
+float ParticleManager::getSlowMotion() const
+{
+    return _slowMotion;
+}
+
+void ParticleManager::setSlowMotion(float factor)
+{
+    wakeAll();
+    _slowMotion = factor;
+}
+
+bool ParticleManager::getSleeping() const
+{
+    return _sleeping;
+}
+
+void ParticleManager::setSleeping(bool sleeping)
+{
+    _sleeping = sleeping;
+    wakeAll();
+}
+
+void ParticleManager::updateActivity()
+{
+    if (!_sleeping)
+        return;
+
+    // A calm cell sleeps unless one of its neighbours moved during the last step
+    for (int y{}; y < COL_SIZE; ++y)
+        for (int x{}; x < ROW_SIZE; ++x)
         {
-            p.vy *= BOUND_DAMPING;
-            p.y = SCREEN_HEIGHT - PARTICLE_RADIUS;
+            uint id = Shape::cellId(x, y);
+            bool asleep = _cellCalmSteps[id] >= SLEEP_STEPS;
+
+            if (asleep)
+                Shape::forEachNeighbourCell(x, y, [&](uint near) { asleep = asleep && !_cellMoving[near]; });
+
+            _cellAsleep[id] = asleep;
         }
+
+    for (uint id{}; id < NB_CELLS; ++id)
+    {
+        if (_cellMoving[id])
+            _cellCalmSteps[id] = 0;
+        else if (_cellCalmSteps[id] < SLEEP_STEPS)
+            ++_cellCalmSteps[id];
+
+        _cellMoving[id] = false;
+    }
+}
+
+void ParticleManager::wakeAll()
+{
+    std::fill(_cellCalmSteps.begin(), _cellCalmSteps.end(), 0);
+    // Set by integrate even while sleeping is off, when updateActivity does not clear them
+    std::fill(_cellMoving.begin(), _cellMoving.end(), false);
+    std::fill(_cellAsleep.begin(), _cellAsleep.end(), false);
+}
+
+void ParticleManager::wakeRect(double left, double top, double right, double bottom)
+{
+    // One more cell around the rectangle, so the fluid next to it can react
+    int x0 = std::max(static_cast<int>(left) / CEll_SIZE - 1, 0);
+    int y0 = std::max(static_cast<int>(top) / CEll_SIZE - 1, 0);
+    int x1 = std::min(static_cast<int>(right) / CEll_SIZE + 1, ROW_SIZE - 1);
+    int y1 = std::min(static_cast<int>(bottom) / CEll_SIZE + 1, COL_SIZE - 1);
+
+    for (int y{ y0 }; y <= y1; ++y)
+        for (int x{ x0 }; x <= x1; ++x)
+        {
+            uint id = Shape::cellId(x, y);
+            _cellCalmSteps[id] = 0;
+            _cellAsleep[id] = false;
+        }
+}
+
+void ParticleManager::integrate(double dt)
+{
+    // A resting particle keeps less than one step of gravity in its velocity
+    _sleepSpeedSq = GRAVITY * dt * GRAVITY * dt;
+
+    // The neighbours read the velocities during the force pass, so the leapfrog kicks
+    // wait for this pass: the end of the last step and the start of this one
+    double kick = dt;
+    if (_integrator == Integrator::Leapfrog)
+    {
+        kick = (_lastStep + dt) * 0.5;
+        _lastStep = dt;
+    }
+
+    bool colored = _colorMode != ColorMode::Material;
+    if (colored)
+    {
+        _particleColors.resize(_particles.size(), _color);
+        _workerColorMin.assign(_workers.size(), 1e300);
+        _workerColorMax.assign(_workers.size(), -1e300);
+    }
+
+    _passes.run(_workers, _grid, [this, kick, dt, colored](uint i, uint worker)
+    {
+        Particle& p = _particles[i];
+        uint cell = Shape::cellOf(p);
+
+        integrate(i, kick, dt);
+
+        if (p.vx * p.vx + p.vy * p.vy > _sleepSpeedSq)
+            _cellMoving[cell] = true;
+
+        if (colored)
+            colorParticle(i, worker);
+    });
+
+    if (colored)
+        updateColorRange();
+}
+
+namespace
+{
+    // Blue, cyan, yellow, red, as the density display
+    Color heatColor(double t, uchar alpha)
+    {
+        static const Color stops[] = { { 25, 50, 205, 0 }, { 25, 190, 230, 0 }, { 240, 215, 50, 0 }, { 215, 40, 25, 0 } };
+
+        t = std::clamp(t, 0.0, 1.0) * 3;
+        int k = std::min(static_cast<int>(t), 2);
+        double f = t - k;
+        const Color& a = stops[k];
+        const Color& b = stops[k + 1];
+
+        return { static_cast<uchar>(a.r + (b.r - a.r) * f), static_cast<uchar>(a.g + (b.g - a.g) * f),
+                 static_cast<uchar>(a.b + (b.b - a.b) * f), alpha };
+    }
+}
+
+void ParticleManager::colorParticle(uint i, uint worker)
+{
+    const Particle& p = _particles[i];
+
+    double value = 0;
+    switch (_colorMode)
+    {
+    case ColorMode::Speed:
+        value = sqrt(p.vx * p.vx + p.vy * p.vy);
+        break;
+    case ColorMode::Pressure:
+        value = p.p;
+        break;
+    case ColorMode::Density:
+        value = p.rho;
+        break;
+    default:
+        break;
+    }
+
+    // Normalized with the range of the last steps, this one is known once every particle is done
+    double range = _colorMax - _colorMin;
+    _particleColors[i] = heatColor(range > 0 ? (value - _colorMin) / range : 0.5, _color.a);
+
+    _workerColorMin[worker] = std::min(_workerColorMin[worker], value);
+    _workerColorMax[worker] = std::max(_workerColorMax[worker], value);
+}
+
+void ParticleManager::updateColorRange()
+{
+    double low = *std::min_element(_workerColorMin.begin(), _workerColorMin.end());
+    double high = *std::max_element(_workerColorMax.begin(), _workerColorMax.end());
+    if (low > high)
+        return; // every particle asleep
+
+    // Widens at once, narrows over a few seconds so the colors do not flicker
+    if (_colorMin > _colorMax)
+    {
+        _colorMin = low;
+        _colorMax = high;
+        return;
+    }
+
+    _colorMin = low < _colorMin ? low : _colorMin + (low - _colorMin) * 0.05;
+    _colorMax = high > _colorMax ? high : _colorMax + (high - _colorMax) * 0.05;
+}
+
+void ParticleManager::integrate(uint i, double kick, double dt)
+{
+    Particle& p = _particles[i];
+
+    Passes::kickDrift(p, kick, dt);
+
+    // the velocity itself is kept, only the motion is smoothed
+    if (_xsph > 0)
+    {
+        p.x += dt*_xsphVelocity[2 * i];
+        p.y += dt*_xsphVelocity[2 * i + 1];
+    }
+
+    enforceBoundaries(p);
+}
+
+void ParticleManager::enforceBoundaries(Particle& p)
+{
+    // enforce boundary conditions, the boundary particles keep the fluid away from them otherwise
+    Passes::enforceWalls(p, PARTICLE_RADIUS, BOUND_DAMPING);
+
+    if (!_obstacles.isEmpty())
+        collideObstacles(p);
+}
+
+void ParticleManager::collideObstacles(Particle& p)
+{
+    double nx, ny;
+    double dist = _obstacles.sample(p.x, p.y, nx, ny);
+    if (dist >= PARTICLE_RADIUS)
+        return;
+
+    double norm = sqrt(nx * nx + ny * ny);
+    if (norm == 0)
+        return;
+    nx /= norm;
+    ny /= norm;
+
+    // Back on the surface, and damp the normal velocity like the walls do
+    p.x += (PARTICLE_RADIUS - dist) * nx;
+    p.y += (PARTICLE_RADIUS - dist) * ny;
+
+    double vn = p.vx * nx + p.vy * ny;
+    if (vn < 0)
+    {
+        p.vx += (BOUND_DAMPING - 1) * vn * nx;
+        p.vy += (BOUND_DAMPING - 1) * vn * ny;
+    }
+}
+
+namespace
+{
+    // Calls f with a std::bool_constant for each flag, in order, so that every combination
+    // of the flags is its own instance of the template f calls
+    template <typename F>
+    void withFlags(F&& f)
+    {
+        f();
+    }
+
+    template <typename F, typename... Flags>
+    void withFlags(F&& f, bool flag, Flags... flags)
+    {
+        if (flag)
+            withFlags([&](auto... rest) { f(std::true_type{}, rest...); }, flags...);
+        else
+            withFlags([&](auto... rest) { f(std::false_type{}, rest...); }, flags...);
     }
 }
 
 void ParticleManager::computeDensityPressure()
+{
+    withFlags([this](auto mixed, auto tension)
+    {
+        densityPass<decltype(mixed)::value, decltype(tension)::value>();
+    }, _otherMaterial > 0, _surfaceTension);
+
+    for (uint w{}; w < _workers.size(); ++w)
+        _workerBusy[w] += _workers.getBusyTimes()[w];
+    _steals += _workers.getStealCount();
+}
+
+template <bool MIXED, bool TENSION>
+void ParticleManager::densityPass()
 {
     // Pour chaque particule
-    for (auto &pi : _particles)
+    _passes.run(_workers, _grid, [this](uint i, uint) { computeDensityPressure<MIXED, TENSION>(i); });
+}
+
+template <bool MIXED, bool TENSION>
+void ParticleManager::computeDensityPressure(uint i)
+{
+    Particle& pi = _particles[i];
+
+    pi.rho = 0.f;
+
+    // Gradient of the color field, without the density of the neighbours which is not known yet
+    double gradient_x = {};
+    double gradient_y = {};
+
+    // Chercher toutes les particules qui contribuent à la
+    // pression/densité, dans les 9 cellules autour de la particule
+    Passes::forEachNeighbourCell(pi, [&](uint near)
     {
-        pi.rho = 0.f;
+        Passes::forEachInCell(_grid, _particles, near, pi, HSQ, [&](uint, const Particle& pj, const Passes::Vector& d, double distanceSqrt)
+        {
+            // this computation is symmetric
+            double tmpProcess = HSQ - distanceSqrt;
+            if constexpr (MIXED)
+                pi.rho += MATERIALS[pj.material].mass * POLY6 * tmpProcess * tmpProcess * tmpProcess;
+            else
+                pi.rho += MASS_POLY6 * tmpProcess * tmpProcess * tmpProcess;
+
+            if constexpr (TENSION)
+            {
+                double mass = MIXED ? MATERIALS[pj.material].mass : MASS;
+                gradient_x -= mass * tmpProcess * tmpProcess * d[0];
+                gradient_y -= mass * tmpProcess * tmpProcess * d[1];
+            }
+        });
 
-        // Chercher toutes les particules qui contribuent à la
-        // pression/densité
-        int coordX = refX(pi);
-        int coordY = refY(pi);
+        if (!_boundaryParticles)
+            return;
 
-        // process 9 positions near a particle
-        for (int x{ -1 }; x <= 1; ++x)
+        for (const BoundaryParticles::Sample& b : _boundary.cell(near))
         {
-            int nearX = coordX + x;
-            if (nearX < 0 || nearX >= ROW_SIZE )
-                continue;
+            double tempX = b.x - pi.x;
+            double tempY = b.y - pi.y;
+            double distanceSqrt = tempX * tempX + tempY * tempY;
 
-            for (int y{-1}; y<=1; ++y)
+            if (distanceSqrt < HSQ)
             {
-                int nearY = coordY + y;
-                if (nearY < 0 || nearY >= COL_SIZE)
-                    continue;
-
-                for (Particle* pj : _grid[nearX][nearY])
-                {
-                    double tempX = pj->x - pi.x;
-                    double tempY = pj->y - pi.y;
-                    double distanceSqrt = tempX * tempX + tempY * tempY;
-
-                    if (distanceSqrt < HSQ)
-                    {
-                        // this computation is symmetric
-                        double tmpProcess = HSQ - distanceSqrt;
-                        pi.rho += MASS_POLY6 * tmpProcess * tmpProcess * tmpProcess;
-                    }
-                }
+                double tmpProcess = HSQ - distanceSqrt;
+                pi.rho += BOUNDARY_POLY6 * b.volume * tmpProcess * tmpProcess * tmpProcess;
             }
         }
-            
+    });
+
+    if constexpr (MIXED)
+        pi.p = GAS_CONST*(pi.rho - MATERIALS[pi.material].restDensity);
+    else
         pi.p = GAS_CONST*(pi.rho - REST_DENS);
+
+    // Scaled by the kernel radius, about 1 on the surface and 0 inside the fluid
+    if constexpr (TENSION)
+    {
+        _normals[2 * i] = H * POLY6_GRAD * gradient_x / pi.rho;
+        _normals[2 * i + 1] = H * POLY6_GRAD * gradient_y / pi.rho;
     }
 }
 
 void ParticleManager::computeForces()
 {
-    // Pour chaque particule
-    for (auto &pi : _particles) 
+    withFlags([this](auto mixed, auto tension, auto xsph, auto artificial)
     {
-        double pressure_x = {};
-        double pressure_y = {};
+        forcePass<decltype(mixed)::value, decltype(tension)::value, decltype(xsph)::value, decltype(artificial)::value>();
+    }, _otherMaterial > 0, _surfaceTension, _xsph > 0, _artificialViscosity > 0);
+
+    for (uint w{}; w < _workers.size(); ++w)
+        _workerBusy[w] += _workers.getBusyTimes()[w];
+    _steals += _workers.getStealCount();
+}
+
+template <bool MIXED, bool TENSION, bool XSPH, bool ARTIFICIAL>
+void ParticleManager::forcePass()
+{
+    // Pour chaque particule
+    _passes.run(_workers, _grid, [this](uint i, uint) { computeForces<MIXED, TENSION, XSPH, ARTIFICIAL>(i); });
+}
+
+template <bool MIXED, bool TENSION, bool XSPH, bool ARTIFICIAL>
+void ParticleManager::computeForces(uint i)
+{
+    Particle& pi = _particles[i];
+
+    Passes::Vector pressure = {};
+    Passes::Vector viscosity = {};
+
+    double tension_x = {};
+    double tension_y = {};
+
+    double xsph_x = {};
+    double xsph_y = {};
 
-        double viscosity_x = {};
-        double viscosity_y = {};
+    double artificial_x = {};
+    double artificial_y = {};
 
-        int coordX = refX(pi);
-        int coordY = refY(pi);
-        
-        // process 9 positions near a particle
-        for (int x{ -1 }; x <= 1; ++x)
+    // process 9 positions near a particle
+    Passes::forEachNeighbourCell(pi, [&](uint near)
+    {
+        // Calculer la somme des forces de viscosité et pression appliquées par les autres particules
+        Passes::forEachInCell(_grid, _particles, near, pi, HSQ, [&](uint j, const Particle& pj, const Passes::Vector& d, double rSqrt)
         {
-            int nearX = coordX + x;
-            if (nearX < 0 || nearX >= ROW_SIZE)
-                continue;
+            if (i == j)
+                return;
+
+            double r = sqrt(rSqrt);
+            double tmpProcess = H - r;
+            double massSpikyGrad = MASS_SPIKY_GRAD;
+            double massViscLap = MASS_VISC_LAP;
 
-            for (int y{ -1 }; y <= 1; ++y)
+            // The viscosity of a pair is the mean of the two fluids
+            if constexpr (MIXED)
             {
-                int nearY = coordY + y;
-                if (nearY < 0 || nearY >= COL_SIZE)
-                    continue;
+                const Material& mj = MATERIALS[pj.material];
+                massSpikyGrad = mj.mass * SPIKY_GRAD;
+                massViscLap = mj.mass * (MATERIALS[pi.material].viscosity + mj.viscosity) * 0.5 * VISC_LAP;
+            }
 
-                // Calculer la somme des forces de viscosité et pression appliquées par les autres particules
-                for (Particle* pj : _grid[nearX][nearY])
+            Passes::addPressureViscosity(pi, pj, d, r, H, massSpikyGrad, massViscLap, pressure, viscosity);
+
+            double mass = MIXED ? MATERIALS[pj.material].mass : MASS;
+
+            // mean velocity of the neighbourhood
+            if constexpr (XSPH)
+            {
+                double w = HSQ - rSqrt;
+                double fxsph = mass * POLY6 * w * w * w / ((pi.rho + pj.rho) * 0.5);
+                xsph_x += fxsph * (pj.vx - pi.vx);
+                xsph_y += fxsph * (pj.vy - pi.vy);
+            }
+
+            // Monaghan artificial viscosity, only between particles getting closer
+            if constexpr (ARTIFICIAL)
+            {
+                double approach = (pi.vx - pj.vx) * (pi.x - pj.x) + (pi.vy - pj.vy) * (pi.y - pj.y);
+                if (approach < 0)
                 {
-                    if (&pi == pj)
-                        continue;
-
-                    double tmpX = pj->x - pi.x;
-                    double tmpY = pj->y - pi.y;
-                    double rSqrt = tmpX * tmpX + tmpY * tmpY;
-
-                    if (rSqrt < HSQ)
-                    {
-                        double r = sqrt(rSqrt);
-
-                        // compute pressure force contribution
-                        double tmpProcess = H - r;
-                        double fpress = MASS_SPIKY_GRAD * (pi.p + pj->p) / (2.0 * pj->rho) * tmpProcess * tmpProcess;
-                        pressure_x += (pi.x - pj->x) / r * fpress;
-                        pressure_y += (pi.y - pj->y) / r * fpress;
-
-                        // compute viscosity force contribution
-                        viscosity_x += MASS_VISC_LAP * (pj->vx - pi.vx) / pj->rho * (H-r);
-                        viscosity_y += MASS_VISC_LAP * (pj->vy - pi.vy) / pj->rho * (H-r);
-                    }
+                    double mu = H * approach / (rSqrt + 0.01 * HSQ);
+                    double viscous = -_artificialViscosity * SOUND_SPEED * mu / ((pi.rho + pj.rho) * 0.5);
+                    double fav = -pi.rho * mass * viscous * SPIKY_GRAD * tmpProcess * tmpProcess / r;
+                    artificial_x += fav * (pi.x - pj.x);
+                    artificial_y += fav * (pi.y - pj.y);
                 }
             }
+
+            // cohesion, repulsive when too close, and curvature that flattens the surface,
+            // both stronger where the fluid is thinner than settled
+            if constexpr (TENSION)
+            {
+                double correction = 2.0 * SETTLED_DENS / (pi.rho + pj.rho);
+                double spline = (H - r) * (H - r) * (H - r) * rSqrt * r;
+                if (r <= H * 0.5)
+                    spline = 2.0 * spline - COHESION_OFFSET;
+
+                double fcoh = mass * COHESION * spline / r;
+                tension_x -= correction * (fcoh * (pi.x - pj.x) + (_normals[2 * i] - _normals[2 * j]));
+                tension_y -= correction * (fcoh * (pi.y - pj.y) + (_normals[2 * i + 1] - _normals[2 * j + 1]));
+            }
+        });
+
+        if (!_boundaryParticles)
+            return;
+
+        // Pressure of the boundary mirrored from the particle, the boundary does not slow the fluid down
+        for (const BoundaryParticles::Sample& b : _boundary.cell(near))
+        {
+            double tmpX = b.x - pi.x;
+            double tmpY = b.y - pi.y;
+            double rSqrt = tmpX * tmpX + tmpY * tmpY;
+
+            if (rSqrt < HSQ && rSqrt > 0)
+            {
+                double r = sqrt(rSqrt);
+
+                double tmpProcess = H - r;
+                double fpress = BOUNDARY_SPIKY_GRAD * b.volume * pi.p / pi.rho * tmpProcess * tmpProcess;
+                pressure[0] += (pi.x - b.x) / r * fpress;
+                pressure[1] += (pi.y - b.y) / r * fpress;
+            }
         }
+    });
 
-        pi.fx = pressure_x + viscosity_x + _ax * pi.rho;
-        pi.fy = pressure_y + viscosity_y + _ay * pi.rho;
+    pi.fx = pressure[0] + viscosity[0] + _ax * pi.rho;
+    pi.fy = pressure[1] + viscosity[1] + _ay * pi.rho;
+
+    if constexpr (ARTIFICIAL)
+    {
+        pi.fx += artificial_x;
+        pi.fy += artificial_y;
+    }
+
+    if constexpr (XSPH)
+    {
+        _xsphVelocity[2 * i] = _xsph * xsph_x;
+        _xsphVelocity[2 * i + 1] = _xsph * xsph_y;
+    }
+
+    if constexpr (TENSION)
+    {
+        pi.fx += SURFACE_TENSION * pi.rho * tension_x;
+        pi.fy += SURFACE_TENSION * pi.rho * tension_y;
+    }
+
+    if (_obstaclePressure && !_obstacles.isEmpty())
+    {
+        double nx, ny;
+        double dist = _obstacles.sample(pi.x, pi.y, nx, ny);
+        double norm = sqrt(nx * nx + ny * ny);
+
+        // Grows from nothing at the kernel radius to OBSTACLE_PRESSURE on the surface
+        if (dist < H && norm > 0)
+        {
+            double tmpProcess = (H - std::max(dist, 0.0)) / H;
+            double fpress = OBSTACLE_PRESSURE * pi.rho * tmpProcess * tmpProcess / norm;
+            pi.fx += nx * fpress;
+            pi.fy += ny * fpress;
+        }
     }
 }
 
 void ParticleManager::update()
 {
-    float dt = GetFrameTime();
+    update(GetFrameTime());
+}
 
-    feedGrid();
+void ParticleManager::update(float dt)
+{
+    // The last frame ran its update and render
+    _timers.nextFrame();
 
-    computeDensityPressure();
-    computeForces();
-    integrate(dt/10);
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Grid);
+        feedGrid();
+        applyBrushes();
+        publishSnapshot();
+        updateActivity();
+        _passes.build(_grid, _cellAsleep);
+    }
+
+    std::fill(_workerBusy.begin(), _workerBusy.end(), 0.0);
+    _steals = 0;
+
+    if (_xsph > 0)
+        _xsphVelocity.resize(2 * _particles.size());
+    if (_surfaceTension)
+        _normals.resize(2 * _particles.size());
+
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Density);
+        computeDensityPressure();
+    }
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Forces);
+        computeForces();
+    }
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Integrate);
+        integrate(dt / _slowMotion);
+        drainSinks();
+        feedEmitters(dt);
+    }
 }
 
 void ParticleManager::setRenderMode(uchar mask)
@@ -317,21 +1448,139 @@ void ParticleManager::setRenderMode(uchar mask)
     _renderMode = mask;
 }
 
-void ParticleManager::renderParticles() 
+void ParticleManager::collectParticles(std::vector<Quad>& quads)
 {
+    // Color of each material, the first one can be changed by the user
+    Palette palette;
+    for (uint m{}; m < NB_MATERIALS; ++m)
+        palette[m] = MATERIALS[m].color;
+    palette[0] = _color;
+
+    // More particles than the screen can show apart, the cost is kept to one splat per LOD cell
+    double perPixel = static_cast<double>(_particles.size()) / (SCREEN_WIDTH * SCREEN_HEIGHT);
+    if (perPixel > LOD_ON)
+        _lod = true;
+    else if (perPixel < LOD_OFF)
+        _lod = false;
+
+    // The colors of integrate cover the first particles, the ones added since have the color of
+    // their material until the next step. Each range has its own loop, with one color source.
+    uint colored = _colorMode != ColorMode::Material ? static_cast<uint>(std::min(_particleColors.size(), _particles.size())) : 0;
+
+    if (_lod)
+    {
+        collectLod(quads, colored, palette);
+        return;
+    }
+
     Rectangle r{};
+    r.width  = static_cast<float>(PARTICLE_RADIUS * 2);
+    r.height = static_cast<float>(PARTICLE_RADIUS * 2);
 
-    // Draw particles
-    for (long unsigned int i=0; i<_particles.size(); i++) 
+    for (uint i{}; i < colored; ++i)
+    {
+        r.x = static_cast<float>(_particles[i].x - PARTICLE_RADIUS);
+        r.y = static_cast<float>(_particles[i].y - PARTICLE_RADIUS);
+        quads.push_back({ r, _particleColors[i] });
+    }
+
+    for (uint i{ colored }; i < _particles.size(); ++i)
     {
         r.x = static_cast<float>(_particles[i].x - PARTICLE_RADIUS);
         r.y = static_cast<float>(_particles[i].y - PARTICLE_RADIUS);
-        r.width  = static_cast<float>(PARTICLE_RADIUS * 2);
-        r.height = static_cast<float>(PARTICLE_RADIUS * 2);
-        DrawRectangleRec(r, _color);
+        quads.push_back({ r, palette[_particles[i].material] });
     }
 }
 
+void ParticleManager::collectLod(std::vector<Quad>& quads, uint colored, const Palette& palette)
+{
+    // Each worker bins its chunk of the particles into its own cells, which are then summed into the first ones
+    const uint nbCells = LOD_ROW * LOD_COL;
+    _lodCells.assign(_workers.size() * nbCells, LodCell{});
+
+    _workers.parallelFor(static_cast<uint>(_particles.size()), [this, colored, &palette](uint begin, uint end, uint worker)
+    {
+        LodCell* cells = _lodCells.data() + worker * nbCells;
+        auto bin = [this, cells](uint first, uint last, auto colorOf)
+        {
+            for (uint i{ first }; i < last; ++i)
+            {
+                const Particle& p = _particles[i];
+                int x = std::clamp(static_cast<int>(p.x) / LOD_CELL, 0, LOD_ROW - 1);
+                int y = std::clamp(static_cast<int>(p.y) / LOD_CELL, 0, LOD_COL - 1);
+                LodCell& cell = cells[x + y * LOD_ROW];
+                const Color& c = colorOf(i);
+
+                ++cell.count;
+                cell.x += p.x;
+                cell.y += p.y;
+                cell.vx += p.vx;
+                cell.vy += p.vy;
+                cell.r += c.r;
+                cell.g += c.g;
+                cell.b += c.b;
+                cell.a += c.a;
+            }
+        };
+
+        bin(begin, std::min(end, colored), [this](uint i) -> const Color& { return _particleColors[i]; });
+        bin(std::max(begin, colored), end, [this, &palette](uint i) -> const Color& { return palette[_particles[i].material]; });
+    });
+
+    _workers.parallelFor(nbCells, [this](uint begin, uint end, uint)
+    {
+        for (uint id{ begin }; id < end; ++id)
+            for (uint worker{ 1 }; worker < _workers.size(); ++worker)
+            {
+                LodCell& cell = _lodCells[id];
+                const LodCell& part = _lodCells[worker * nbCells + id];
+
+                cell.count += part.count;
+                cell.x += part.x;
+                cell.y += part.y;
+                cell.vx += part.vx;
+                cell.vy += part.vy;
+                cell.r += part.r;
+                cell.g += part.g;
+                cell.b += part.b;
+                cell.a += part.a;
+            }
+    });
+
+    for (uint id{}; id < nbCells; ++id)
+    {
+        const LodCell& cell = _lodCells[id];
+        if (cell.count == 0)
+            continue;
+
+        double n = cell.count;
+        double x = cell.x / n, y = cell.y / n;
+
+        // From the size of one particle to the whole cell as the count grows, stretched along
+        // the mean velocity, and as opaque as the particles piled on each other
+        double half = PARTICLE_RADIUS + (LOD_CELL * 0.5 - PARTICLE_RADIUS) * (1.0 - 1.0 / n);
+        double halfWidth = half + std::min(fabs(cell.vx / n) * LOD_STREAK, LOD_CELL * 0.25);
+        double halfHeight = half + std::min(fabs(cell.vy / n) * LOD_STREAK, LOD_CELL * 0.25);
+        double alpha = 1.0 - pow(1.0 - cell.a / n / 255.0, n);
+
+        Rectangle r{ static_cast<float>(x - halfWidth), static_cast<float>(y - halfHeight),
+                     static_cast<float>(2 * halfWidth), static_cast<float>(2 * halfHeight) };
+        Color c{ static_cast<uchar>(cell.r / n), static_cast<uchar>(cell.g / n), static_cast<uchar>(cell.b / n),
+                 static_cast<uchar>(alpha * 255) };
+        quads.push_back({ r, c });
+    }
+}
+
+void ParticleManager::renderParticles() 
+{
+    // Draw particles
+    _quads.clear();
+    collectParticles(_quads);
+
+    for (const Quad& q : _quads)
+        DrawRectangleRec(q.rect, q.color);
+}
+
 void ParticleManager::renderGrid() 
 {
     for (uint i{}; i < ROW_SIZE; ++i)
@@ -348,8 +1597,18 @@ void ParticleManager::renderGrid()
 }
 
 void ParticleManager::renderCells() 
+{
+    _quads.clear();
+    collectCells(_quads);
+
+    for (const Quad& q : _quads)
+        DrawRectangleRec(q.rect, q.color);
+}
+
+void ParticleManager::collectCells(std::vector<Quad>& quads) const
 {
     Color c{ 0, 0, 255 };
+    Color asleep{ 0, 160, 0, 255 };
     Rectangle r{};
 
     for (uint i{}; i < NB_CELLS; ++i)
@@ -363,15 +1622,68 @@ void ParticleManager::renderCells()
         r.height = static_cast<float>(CEll_SIZE);
 
 
-        c.a = (_grid[x][y].size() * ALPHA_RATIO) % 256;
+        c.a = (_grid.count(i) * ALPHA_RATIO) % 256;
+        asleep.a = c.a;
 
         if (c.a > 0)
-            DrawRectangleRec(r, c);
+            quads.push_back({ r, _cellAsleep[i] ? asleep : c });
+    }
+}
+
+void ParticleManager::renderEmitters()
+{
+    for (const Sink& sink : _sinks)
+        DrawRectangleLines(static_cast<int>(sink.left), static_cast<int>(sink.top),
+                           static_cast<int>(sink.right - sink.left), static_cast<int>(sink.bottom - sink.top), DARKGRAY);
+
+    for (const Emitter& e : _emitters)
+    {
+        double speed = sqrt(e.vx * e.vx + e.vy * e.vy);
+        if (speed == 0)
+            continue;
+
+        // The nozzle, across the jet
+        float nx = static_cast<float>(-e.vy / speed * e.width * 0.5);
+        float ny = static_cast<float>(e.vx / speed * e.width * 0.5);
+        Vector2 from{ static_cast<float>(e.x) - nx, static_cast<float>(e.y) - ny };
+        Vector2 to{ static_cast<float>(e.x) + nx, static_cast<float>(e.y) + ny };
+        DrawLineEx(from, to, 3, DARKGRAY);
+    }
+}
+
+void ParticleManager::prepareRender()
+{
+    if (_renderMode & (uchar)Render::Surface)
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Surface);
+        _surface.prepare(_particles, static_cast<float>(SURFACE_RADIUS));
     }
 }
 
 void ParticleManager::render()
 {
+    _obstacles.render();
+    renderEmitters();
+
+    if (_renderMode & (uchar)Render::Surface)
+    {
+        PhaseTimers::Scope timer(_timers, Phase::Surface);
+        _surface.render(_color);
+    }
+
+    PhaseTimers::Scope timer(_timers, Phase::Render);
+
+    if (_renderMode & (uchar)Render::Density)
+    {
+        // The field stays valid until the next step publishes a snapshot, paused or not
+        if (_densityStale)
+        {
+            _densityField.update(*getSnapshot(), _workers);
+            _densityStale = false;
+        }
+        _densityField.render(static_cast<float>(DENSITY_SCALE));
+    }
+
     if (_renderMode & (uchar)Render::Particles)
         renderParticles();
 
@@ -379,5 +1691,22 @@ void ParticleManager::render()
     {
         renderCells();
         renderGrid();
+
+        if (_boundaryParticles)
+            _boundary.render();
     }
 }
+
+void ParticleManager::render(SoftwareRenderer& renderer)
+{
+    // Same order as render
+    _quads.clear();
+
+    if (_renderMode & (uchar)Render::Particles)
+        collectParticles(_quads);
+
+    if (_renderMode & (uchar)Render::DrawGrid)
+        collectCells(_quads);
+
+    renderer.draw(_quads, _workers);
+}
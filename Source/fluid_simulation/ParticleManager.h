@@ -12,50 +12,108 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
 #include <raylib.h>
 
 #include "Globals.h"
+#include "Particle.h"
+#include "Kernels.h"
+#include "SpatialGrid.h"
+#include "NeighbourPasses.h"
+#include "SdfField.h"
+#include "BoundaryParticles.h"
+#include "Emitters.h"
+#include "Materials.h"
+#include "FluidSnapshot.h"
+#include "DensityField.h"
+#include "FluidSurface.h"
+#include "PhaseTimers.h"
+#include "SoftwareRenderer.h"
+#include "Scene.h"
+#include "ThreadPool.h"
 
 namespace SPH
 {
-    // Particle data structure
-    struct Particle
+    enum class Render
     {
-        Particle() = default;
-        Particle(double, double);
-        double x, y;   // Position
-        double vx, vy; // Velocity
-        double fx, fy; // Total forces
-        double rho;    // Density
-        double p;      // Pressure
+        Particles   = 1 << 0,
+        DrawGrid    = 1 << 1,
+        Density     = 1 << 2,
+        Surface     = 1 << 3
     };
 
-    enum class Render
+    // Time stepping of the particles, both integrators move them with the velocity they just got
+    enum class Integrator
     {
-        Particles   = 1 << 0,
-        DrawGrid    = 1 << 1
+        SemiImplicitEuler,  // a whole step of acceleration, then a whole step of motion
+        Leapfrog            // kick-drift-kick, the closing half kick of a step done with the opening one of the next
+    };
+
+    // What the color of a 2D particle shows
+    enum class ColorMode
+    {
+        Material,   // the color of its fluid
+        Speed,
+        Pressure,
+        Density,
+        Count
+    };
+
+    // Velocity a brush stroke gave a particle, over all its samples
+    struct BrushTouch
+    {
+        uint id;
+        double vx, vy;
+    };
+
+    // What a brush stroke did, to take it back
+    struct BrushRecord
+    {
+        std::vector<BrushTouch> touches; // sorted by id
+        double left = 1e300, top = 1e300, right = -1e300, bottom = -1e300; // reached by the samples applied
     };
 
     class ParticleManager
     {
         using cint = const int;
         using cdouble = const double;
+        using cfloat = const float;
+        using Shape = SpatialGrid::Shape;
+        using Passes = NeighbourPasses<2>;
+
+        inline static cdouble H = 16.0; // kernel radius, must match the grid cell size
+        inline static cint CEll_SIZE = Shape::CEll_SIZE;
+        inline static cint ROW_SIZE = Shape::ROW_SIZE;
+        inline static cint COL_SIZE = Shape::COL_SIZE;
+        inline static cint NB_CELLS = Shape::NB_CELLS;
 
-        inline static cdouble H = 16.0; // kernel radius
-        inline static cint BDH = 4; // kernel radius
-        inline static cint CEll_SIZE = static_cast<cint>(H);
-        inline static cint ROW_SIZE = SCREEN_WIDTH >> BDH;
-        inline static cint COL_SIZE = SCREEN_HEIGHT >> BDH;
-        inline static cint NB_CELLS = ROW_SIZE * COL_SIZE;
+        inline static cint SLEEP_STEPS = 30; // calm steps before a cell falls asleep
+        inline static cint MAX_STREAMED = 8000; // emitters pause above this many particles
+
+        // Settled start: a packed lattice relaxed with large steps and most of the velocity
+        // taken out after each one, then cached by the parameters it depends on
+        inline static cint RELAX_STEPS = 60;
+        inline static cfloat RELAX_SLOW_MOTION = 5.0f; // twice the usual step
+        inline static cdouble RELAX_DAMPING = 0.5;
+        inline static cdouble LATTICE_SPACING = 3.0; // denser than at rest, the relaxation spreads it
+        inline static cint SETTLED_VERSION = 1;      // to change with anything else the result depends on
+        inline static const char* SETTLED_CACHE = "cache"; // directory of the cache files
 
         const Color defaultColor{ 230, 120, 0, 100 };
         inline static cint ALPHA_LV = 5;
         inline static cint ALPHA_RATIO = 255 / ALPHA_LV;
 
-        using RefList = std::vector<Particle*>;
-
-        using ColumnList = std::array<RefList, COL_SIZE>;
-        using ParticleGrid = std::array<ColumnList, ROW_SIZE>;
+        // Level of detail of the particle display: past LOD_ON particles per pixel,
+        // one splat per occupied LOD cell replaces the particles inside it
+        inline static cint LOD_CELL = 8; // pixels on each side
+        inline static cint LOD_ROW = SCREEN_WIDTH / LOD_CELL;
+        inline static cint LOD_COL = SCREEN_HEIGHT / LOD_CELL;
+        inline static cdouble LOD_ON = 1.0 / 64.0;  // about one particle per LOD cell
+        inline static cdouble LOD_OFF = 0.8 * LOD_ON; // lower, so the display does not flicker around the threshold
+        inline static cdouble LOD_STREAK = 0.002; // seconds of motion a splat is stretched over
 
     public:
         inline static cdouble REST_DENS = 200.0; // rest density
@@ -68,58 +126,308 @@ namespace SPH
 
         // size of a particle
         inline static cdouble PARTICLE_RADIUS = H / 4.0;
+        inline static cdouble SURFACE_RADIUS = H; // of a particle in the surface display
 
         // smoothing kernels defined in Müller and their gradients
-        inline static cdouble POLY6 = 315.0 / (65.0 * PI * pow(H, 9.0));
-        inline static cdouble SPIKY_GRAD = -45.0 / (PI * pow(H, 6.0));
-        inline static cdouble VISC_LAP = 45.0 / (PI * pow(H, 6.0));
+        inline static cdouble POLY6 = Kernels<2>::poly6(H);
+        inline static cdouble SPIKY_GRAD = Kernels<2>::spikyGrad(H);
+        inline static cdouble VISC_LAP = Kernels<2>::viscLap(H);
+
+        inline static cdouble POLY6_GRAD = 6.0 * POLY6; // opposite of the gradient factor of poly6
+        inline static cdouble COHESION = Kernels<2>::cohesion(H);
+        inline static cdouble COHESION_OFFSET = HSQ * HSQ * HSQ / 64.0;
 
         // Pre process constant
         inline static cdouble MASS_POLY6 = MASS * POLY6;
         inline static cdouble MASS_SPIKY_GRAD = MASS * SPIKY_GRAD;
         inline static cdouble MASS_VISC_LAP = MASS * VISC * VISC_LAP;
 
+        // Fluids of a mixture, the first one has the constants above and the color of the manager
+        inline static cint NB_MATERIALS = 3;
+        inline static const std::array<Material, NB_MATERIALS> MATERIALS = {{
+            { "water", MASS, REST_DENS, VISC, { 230, 120, 0, 100 } },
+            { "oil", MASS * 0.8, REST_DENS * 0.8, VISC * 3.0, { 200, 170, 30, 120 } },
+            { "syrup", MASS * 1.3, REST_DENS * 1.3, VISC * 6.0, { 120, 40, 10, 140 } },
+        }};
+
         // simulation parameters
         inline static cdouble BOUND_DAMPING = -0.9;
+        inline static cdouble SURFACE_TENSION = 300.0; // acceleration of the cohesion and curvature terms
+        inline static cdouble SOUND_SPEED = 1000.0; // of the artificial viscosity, about the speed of a falling particle
+        inline static cdouble XSPH_EPSILON = 0.5; // default XSPH smoothing
+        inline static cdouble ARTIFICIAL_ALPHA = 0.1; // default artificial viscosity
+        inline static cfloat SLOW_MOTION = 10.0f; // real time over simulated time, at start
+        inline static cdouble BRUSH_RADIUS = 60.0;
+        inline static cdouble BRUSH_IMPULSE = 200.0; // speed given at the center of the brush, in one frame
+        inline static cdouble OBSTACLE_PRESSURE = 2.0 * GRAVITY; // push of an obstacle surface on a particle touching it
 
-        ParticleManager();
+        // Density this fluid settles at, REST_DENS is never reached with these kernels
+        inline static cdouble SETTLED_DENS = 1.3;
+        inline static cdouble DENSITY_SCALE = 2.0 * SETTLED_DENS; // red on the density display
+
+        // Boundary particles stand for settled fluid
+        inline static cdouble BOUNDARY_DENS = SETTLED_DENS;
+        inline static cdouble BOUNDARY_POLY6 = BOUNDARY_DENS * POLY6;
+        inline static cdouble BOUNDARY_SPIKY_GRAD = BOUNDARY_DENS * SPIKY_GRAD;
+
+        // nbWorkers threads run the passes, the calling one included
+        explicit ParticleManager(uint nbWorkers = std::thread::hardware_concurrency());
 
         void init(ulong);
+        // n particles at rest on the side gravity points to, instead of the falling disc.
+        // Returns true when the state came from the cache.
+        bool initSettled(ulong n);
+        // The same state computed again, without reading or writing the caches
+        void initSettledUncached(ulong n);
+        // Replaces the particles, obstacles, emitters and the parameters the scene declares.
+        // Returns false if its obstacles could not all be read.
+        bool loadScene(const Scene&);
         void addOne(int, int);
         int addBlock(int, int);
         const Color& getColor() const;
         void changeColor(uchar, uchar, uchar);
         void setDefaultColor();
         void removeParticles(uint);
+        // Id the next particle added by addOne, addBlock or an emitter gets, they only grow
+        uint getNextId() const;
+        // Removes the particles added with an id in [first, last)
+        void removeSpawned(uint first, uint last);
         void setGravity(int);
         void explode();
 
         void update();
+        void update(float dt); // without a window, GetFrameTime stays at 0
+        // Offscreen passes of the display, before BeginDrawing
+        void prepareRender();
         void render();
+        // Particles and cells of the render mode drawn on the CPU, no window needed
+        void render(SoftwareRenderer&);
 
         void setRenderMode(uchar);
 
+        GridBackend getGridBackend() const;
+        void setGridBackend(GridBackend);
+
+        Integrator getIntegrator() const;
+        void setIntegrator(Integrator);
+
+        // The scalar modes are colored by integrate, from blue to red over the range of the last frames
+        ColorMode getColorMode() const;
+        void setColorMode(ColorMode);
+
+        // Time each worker spent in the density and force passes of the last update, in seconds
+        const std::vector<double>& getWorkerBusyTimes() const;
+        uint getStealCount() const;
+        // Time spent in each phase of update and render
+        const PhaseTimers& getPhaseTimers() const;
+        // As the last update left them, in the order they were added
+        const std::vector<Particle>& getParticles() const;
+        // Replaces the particles only, the solver goes on with them (the ranks of a DistributedRun)
+        void setParticles(std::vector<Particle>);
+        // Neighbour candidates of the particles of the cell in the last update,
+        // what the density and force passes go through for it
+        uint getCellPairs(uint cell) const;
+        // The particles are drawn aggregated by LOD cell
+        bool isLodActive() const;
+
+        // Static obstacles, see SdfField for the description format
+        bool loadObstacles(const std::string&);
+        bool loadObstacleMask(const std::string&);
+        void clearObstacles();
+        bool hasObstacles() const;
+        // Obstacles also push the particles within the kernel radius, not only the ones hitting them
+        bool getObstaclePressure() const;
+        void setObstaclePressure(bool);
+
+        // Walls and obstacles sampled with static particles that add to the density and
+        // pressure of the fluid next to them, the clamping of integrate is only a safety net then
+        bool getBoundaryParticles() const;
+        void setBoundaryParticles(bool);
+
+        // Cohesion and curvature forces (Akinci et al. 2013), computed in the same neighbour loops
+        bool getSurfaceTension() const;
+        void setSurfaceTension(bool);
+
+        // Stabilisation, both computed with the forces, 0 disables them.
+        // XSPH moves the particles with the mean velocity of their neighbourhood,
+        // Monaghan's artificial viscosity damps the particles getting closer.
+        double getXsph() const;
+        void setXsph(double epsilon);
+        double getArtificialViscosity() const;
+        void setArtificialViscosity(double alpha);
+
+        // Simulated time is the frame time divided by this factor, larger steps when smaller
+        float getSlowMotion() const;
+        void setSlowMotion(float);
+
+        // Particles as they were at the start of the last update, for the queries of the tools.
+        // Can be called from any thread, the snapshot stays valid as long as it is held.
+        std::shared_ptr<const FluidSnapshot> getSnapshot() const;
+
+        // Radial push (strength > 0) or pull (strength < 0) of the particles around (x, y),
+        // strength is a fraction of BRUSH_IMPULSE. The samples are queued and each update applies
+        // the next one, as the cursor went. The velocities they give are kept in record.
+        void addBrushStroke(double x, double y, double strength, const std::shared_ptr<BrushRecord>& record);
+        // Drops the samples of record not applied yet and takes back the velocity the others gave.
+        // Only the particles still around the stroke are looked up, the ones that left keep it.
+        void undoBrush(const std::shared_ptr<BrushRecord>& record);
+
+        // Material of the particles added from now on, by the mouse and the emitters
+        uchar getSpawnMaterial() const;
+        void setSpawnMaterial(uchar);
+
+        // Open boundaries, run by update at the rate of the frames
+        void addEmitter(double x, double y, double vx, double vy, double width, double rate);
+        void addSink(double left, double top, double right, double bottom);
+        void clearEmitters();
+        bool hasEmitters() const;
+
+        // Skip the cells whose fluid has been at rest for SLEEP_STEPS steps
+        bool getSleeping() const;
+        void setSleeping(bool);
+
     private:
         double _ax, _ay; // Gravity
 
-        void clearGrid();
         void feedGrid();
-        uint refX(const Particle&);
-        uint refY(const Particle&);
+
+        void updateActivity();
+        void wakeAll();
+        void wakeRect(double, double, double, double);
 
         void integrate(double dt);
+        void integrate(uint, double kick, double dt);
+        void enforceBoundaries(Particle&);
+        void collideObstacles(Particle&);
+
+        Integrator _integrator;
+        double _lastStep; // of the leapfrog, 0 when its velocities are not half a step ahead
 
+        ColorMode _colorMode;
+        std::vector<Color> _particleColors; // by integrate, in the order of the particles
+        double _colorMin, _colorMax;         // range the colors are normalized with
+        std::vector<double> _workerColorMin; // of this step, reduced after integrate
+        std::vector<double> _workerColorMax;
+        void colorParticle(uint, uint worker);
+        void updateColorRange();
+
+        // MIXED reads the constants of each particle's material, otherwise they all are the first one.
+        // TENSION adds the normals to the density pass and the surface tension to the forces.
+        // XSPH and ARTIFICIAL add the mean velocity and the artificial viscosity to the forces.
         void computeDensityPressure();
+        template <bool MIXED, bool TENSION>
+        void densityPass();
+        template <bool MIXED, bool TENSION>
+        void computeDensityPressure(uint);
         void computeForces();
+        template <bool MIXED, bool TENSION, bool XSPH, bool ARTIFICIAL>
+        void forcePass();
+        template <bool MIXED, bool TENSION, bool XSPH, bool ARTIFICIAL>
+        void computeForces(uint);
         std::vector<Particle> _particles;
         Color _color{ defaultColor};
 
+        uchar _spawnMaterial;
+        uint _nextId; // of the next spawned particle
+        size_t _otherMaterial; // particles not of the first material, kept by the changes of the particles
+        bool _surfaceTension;
+        std::vector<double> _normals; // surface normal of each particle for this step, x then y, with the surface tension
+
+        double _xsph;
+        double _artificialViscosity;
+        std::vector<double> _xsphVelocity; // correction of each particle for this step, x then y
+        float _slowMotion;
+        Particle spawn(double x, double y);
+
+        SdfField _obstacles;
+        bool _obstaclePressure;
+
+        BoundaryParticles _boundary;
+        bool _boundaryParticles;
+        void rebuildBoundary();
+
+        struct BrushStroke
+        {
+            double x, y;
+            double strength;
+            std::shared_ptr<BrushRecord> record;
+        };
+        std::vector<BrushStroke> _brushStrokes;
+        size_t _brushCursor; // next sample to apply
+        std::vector<BrushTouch> _brushTouched; // by the sample being applied
+        void applyBrushes();
+        // Calls f(i) for the particles in the grid cells over the rectangle, as the grid was built
+        template <typename F>
+        void forEachInCells(double left, double top, double right, double bottom, F&& f);
+
+        // Published snapshot, and the previous one reused once no reader holds it
+        std::shared_ptr<FluidSnapshot> _snapshot;
+        std::shared_ptr<FluidSnapshot> _spareSnapshot;
+        bool _densityStale; // a snapshot was published since _densityField was updated
+        std::vector<double> _materialMass;
+        void publishSnapshot();
+
+        std::vector<Emitter> _emitters;
+        std::vector<Sink> _sinks;
+        void drainSinks();
+        void feedEmitters(double dt);
+        void removeAt(uint);
+
+        // Lattice sites of the blocks, rows generated in parallel, the jitter only depends on the seed
+        void fillBlocks(const Scene&);
+
+        uint64_t settledKey(ulong n) const;
+        void packLattice(ulong n);
+        void countMaterials();
+        void relax();
+        bool readSettled(const std::string& fileName, ulong n);
+        void writeSettled(const std::string& fileName) const;
+        std::unordered_map<uint64_t, std::vector<Particle>> _settledCache;
+
         uchar _renderMode;
         void renderParticles();
+        void renderEmitters();
 
         void renderGrid();
         void renderCells();
 
-        ParticleGrid _grid;
+        // Rectangles drawn by renderParticles and renderCells, shared with the software renderer
+        void collectParticles(std::vector<Quad>&);
+        void collectCells(std::vector<Quad>&) const;
+        std::vector<Quad> _quads;
+
+        struct LodCell
+        {
+            uint count;
+            double x, y;
+            double vx, vy;
+            double r, g, b, a;
+        };
+
+        // The first colored particles take their color from integrate, the others from the palette
+        using Palette = std::array<Color, NB_MATERIALS>;
+        void collectLod(std::vector<Quad>&, uint colored, const Palette&);
+
+        bool _lod;
+        std::vector<LodCell> _lodCells; // LOD_ROW * LOD_COL cells of each worker
+
+        DensityField _densityField;
+        FluidSurface _surface;
+        PhaseTimers _timers;
+
+        ThreadPool _workers;
+        SpatialGrid _grid;
+
+        Passes _passes; // blocks of awake cells handed to the workers
+
+        std::vector<double> _workerBusy;
+        uint _steals;
+
+        // Activity of the grid cells
+        bool _sleeping;
+        double _sleepSpeedSq;
+        std::vector<uint> _cellCalmSteps;  // steps since a particle of the cell last moved
+        std::vector<uchar> _cellMoving;    // set by integrate when a particle of the cell moves
+        std::vector<uchar> _cellAsleep;
     };
 }
@@ -0,0 +1,184 @@
+#include "ParticleManager3D.h"
+
+#include <raylib.h>
+#include <Code_Utilities_Light_v2.h>
+
+#include "Globals.h"
+
+using namespace SPH;
+
+Particle3D::BasicParticle(double px, double py, double pz)
+    : x(px), y(py), z(pz)
+    , vx{}, vy{}, vz{}
+    , fx{}, fy{}, fz{}
+    , rho{}, p{}
+{}
+
+ParticleManager3D::ParticleManager3D()
+{
+    _ax = 0;
+    _ay = GRAVITY;
+}
+
+void ParticleManager3D::init(ulong n)
+{
+    cout << "Init 3D with " << n << " particles" << endl;
+
+    _particles.clear();
+    _particles.reserve(n);
+
+    // Ellipsoid in the middle of the volume
+    double radiusXY = fmin(SCREEN_WIDTH, SCREEN_HEIGHT) * 0.25;
+    double radiusZ = SCREEN_DEPTH * 0.4;
+
+    while (_particles.size() < n)
+    {
+        double x = BdB::randInt(SCREEN_WIDTH);
+        double y = BdB::randInt(SCREEN_HEIGHT);
+        double z = BdB::randInt(SCREEN_DEPTH);
+
+        double tmpX = (x - SCREEN_WIDTH * 0.5) / radiusXY;
+        double tmpY = (y - SCREEN_HEIGHT * 0.5) / radiusXY;
+        double tmpZ = (z - SCREEN_DEPTH * 0.5) / radiusZ;
+
+        if (tmpX * tmpX + tmpY * tmpY + tmpZ * tmpZ < 1.0)
+            _particles.push_back(Particle3D(x, y, z));
+    }
+
+    feedGrid();
+}
+
+void ParticleManager3D::setGravity(int direction)
+{
+    switch (direction)
+    {
+    case DOWN:
+        _ax = 0;
+        _ay = +GRAVITY;
+        break;
+    case UP:
+        _ax = 0;
+        _ay = -GRAVITY;
+        break;
+    case RIGHT:
+        _ax = +GRAVITY;
+        _ay = 0;
+        break;
+    default:
+        _ax = -GRAVITY;
+        _ay = 0;
+    }
+}
+
+void ParticleManager3D::explode()
+{
+    for (auto &p : _particles)
+    {
+        p.vx = BdB::randInt(-5000, 5000);
+        p.vy = BdB::randInt(-5000, 5000);
+        p.vz = BdB::randInt(-5000, 5000);
+    }
+}
+
+GridBackend ParticleManager3D::getGridBackend() const
+{
+    return _grid.getBackend();
+}
+
+void ParticleManager3D::setGridBackend(GridBackend backend)
+{
+    _grid.setBackend(backend);
+}
+
+void ParticleManager3D::feedGrid()
+{
+    _grid.build(_particles, _workers);
+}
+
+void ParticleManager3D::computeDensityPressure()
+{
+    _passes.run(_workers, _grid, [this](uint i, uint) { computeDensityPressure(_particles[i]); });
+}
+
+void ParticleManager3D::computeDensityPressure(Particle3D& pi)
+{
+    pi.rho = 0.f;
+
+    // process 27 positions near a particle
+    Passes::forEachNeighbour(_grid, _particles, pi, HSQ, [&](uint, const Particle3D&, const Passes::Vector&, double distanceSqrt)
+    {
+        double tmpProcess = HSQ - distanceSqrt;
+        pi.rho += MASS_POLY6 * tmpProcess * tmpProcess * tmpProcess;
+    });
+
+    pi.p = GAS_CONST*(pi.rho - REST_DENS);
+}
+
+void ParticleManager3D::computeForces()
+{
+    _passes.run(_workers, _grid, [this](uint i, uint) { computeForces(i); });
+}
+
+void ParticleManager3D::computeForces(uint i)
+{
+    Particle3D& pi = _particles[i];
+
+    Passes::Vector pressure = {};
+    Passes::Vector viscosity = {};
+
+    // process 27 positions near a particle
+    Passes::forEachNeighbour(_grid, _particles, pi, HSQ, [&](uint j, const Particle3D& pj, const Passes::Vector& d, double rSqrt)
+    {
+        if (i != j)
+            Passes::addPressureViscosity(pi, pj, d, sqrt(rSqrt), H, MASS_SPIKY_GRAD, MASS_VISC_LAP, pressure, viscosity);
+    });
+
+    pi.fx = pressure[0] + viscosity[0] + _ax * pi.rho;
+    pi.fy = pressure[1] + viscosity[1] + _ay * pi.rho;
+    pi.fz = pressure[2] + viscosity[2];
+}
+
+void ParticleManager3D::integrate(double dt)
+{
+    // forward Euler integration, then the six walls of the volume
+    _passes.run(_workers, _grid, [this, dt](uint i, uint)
+    {
+        Passes::kickDrift(_particles[i], dt, dt);
+        Passes::enforceWalls(_particles[i], PARTICLE_RADIUS, BOUND_DAMPING);
+    });
+}
+
+void ParticleManager3D::update()
+{
+    float dt = GetFrameTime();
+
+    feedGrid();
+    _passes.build(_grid, {});
+
+    computeDensityPressure();
+    computeForces();
+    integrate(dt/10);
+}
+
+void ParticleManager3D::render()
+{
+    Rectangle r{};
+    r.width  = static_cast<float>(PARTICLE_RADIUS * 2);
+    r.height = static_cast<float>(PARTICLE_RADIUS * 2);
+
+    // The cell ids grow with the depth: walk them backward to draw from back to front
+    for (uint id{ Shape::NB_CELLS }; id-- > 0;)
+        for (uint i : _grid.cell(id))
+        {
+            const Particle3D& p = _particles[i];
+
+            // darker when further
+            float shade = 1.0f - 0.6f * static_cast<float>(p.z / SCREEN_DEPTH);
+            Color c{ static_cast<uchar>(_color.r * shade), static_cast<uchar>(_color.g * shade),
+                     static_cast<uchar>(_color.b * shade), _color.a };
+
+            r.x = static_cast<float>(p.x - PARTICLE_RADIUS);
+            r.y = static_cast<float>(p.y - PARTICLE_RADIUS);
+            DrawRectangleRec(r, c);
+        }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+// Volume version of the simulation, the neighbour passes of ParticleManager (NeighbourPasses.h)
+// with a 27 cells stencil and without the options of the 2D solver.
+// The volume is SCREEN_WIDTH x SCREEN_HEIGHT x SCREEN_DEPTH and is drawn seen from the front.
+
+#include <vector>
+#include <raylib.h>
+
+#include "Globals.h"
+#include "Particle.h"
+#include "Kernels.h"
+#include "NeighbourPasses.h"
+#include "ParticleManager.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+
+namespace SPH
+{
+    class ParticleManager3D
+    {
+        using cint = const int;
+        using cdouble = const double;
+        using Shape = SpatialGrid3D::Shape;
+        using Passes = NeighbourPasses<3>;
+
+        inline static cdouble H = 16.0; // kernel radius, must match the grid cell size
+
+        const Color defaultColor{ 0, 120, 230, 150 };
+
+    public:
+        // Same fluid as the 2D simulation
+        inline static cdouble REST_DENS = ParticleManager::REST_DENS;
+        inline static cdouble GAS_CONST = ParticleManager::GAS_CONST;
+        inline static cdouble HSQ = H*H;
+        inline static cdouble MASS = ParticleManager::MASS;
+        inline static cdouble VISC = ParticleManager::VISC;
+        inline static cdouble GRAVITY = ParticleManager::GRAVITY;
+
+        inline static cdouble PARTICLE_RADIUS = H / 4.0;
+
+        // Pre process constant, with the 3D normalisation of the kernels
+        inline static cdouble MASS_POLY6 = MASS * Kernels<3>::poly6(H);
+        inline static cdouble MASS_SPIKY_GRAD = MASS * Kernels<3>::spikyGrad(H);
+        inline static cdouble MASS_VISC_LAP = MASS * VISC * Kernels<3>::viscLap(H);
+
+        inline static cdouble BOUND_DAMPING = ParticleManager::BOUND_DAMPING;
+
+        ParticleManager3D();
+
+        void init(ulong);
+        void setGravity(int);
+        void explode();
+
+        void update();
+        void render();
+
+        GridBackend getGridBackend() const;
+        void setGridBackend(GridBackend);
+
+    private:
+        double _ax, _ay; // Gravity
+
+        void feedGrid();
+
+        void computeDensityPressure();
+        void computeDensityPressure(Particle3D&);
+        void computeForces();
+        void computeForces(uint);
+        void integrate(double dt);
+
+        std::vector<Particle3D> _particles;
+        Color _color{ defaultColor };
+
+        ThreadPool _workers;
+        SpatialGrid3D _grid;
+        Passes _passes; // blocks of cells handed to the workers
+    };
+}
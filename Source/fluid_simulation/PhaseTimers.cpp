@@ -0,0 +1,52 @@
+#include "PhaseTimers.h"
+
+namespace SPH
+{
+    PhaseTimers::Scope::Scope(PhaseTimers& timers, Phase phase)
+        : _timers(timers)
+        , _phase(phase)
+        , _start(Clock::now())
+    {}
+
+    PhaseTimers::Scope::~Scope()
+    {
+        _timers.add(_phase, std::chrono::duration<double>(Clock::now() - _start).count());
+    }
+
+    PhaseTimers::PhaseTimers()
+        : _frame{}
+        , _average{}
+        , _total{}
+    {}
+
+    void PhaseTimers::nextFrame()
+    {
+        for (size_t p{}; p < _frame.size(); ++p)
+        {
+            _average[p] += (_frame[p] - _average[p]) * 0.1;
+            _frame[p] = 0;
+        }
+    }
+
+    double PhaseTimers::get(Phase phase) const
+    {
+        return _average[static_cast<size_t>(phase)];
+    }
+
+    double PhaseTimers::getTotal(Phase phase) const
+    {
+        return _total[static_cast<size_t>(phase)];
+    }
+
+    const char* PhaseTimers::name(Phase phase)
+    {
+        static const char* names[] = { "Grid", "Density", "Forces", "Integrate", "Render", "Surface" };
+        return names[static_cast<size_t>(phase)];
+    }
+
+    void PhaseTimers::add(Phase phase, double seconds)
+    {
+        _frame[static_cast<size_t>(phase)] += seconds;
+        _total[static_cast<size_t>(phase)] += seconds;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Time spent in each phase of a frame, shown with the thread statistics.
+// A phase is timed by a Scope living as long as the code it measures,
+// several scopes of one phase in a frame add up.
+
+#include <array>
+#include <chrono>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    enum class Phase : uchar
+    {
+        Grid,       // grid, snapshot, sleeping cells and tasks
+        Density,
+        Forces,
+        Integrate,
+        Render,     // particles, grid and density field
+        Surface,    // screen-space fluid surface
+        Count
+    };
+
+    class PhaseTimers
+    {
+        using Clock = std::chrono::steady_clock;
+
+    public:
+        class Scope
+        {
+        public:
+            Scope(PhaseTimers& timers, Phase phase);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            PhaseTimers& _timers;
+            Phase _phase;
+            Clock::time_point _start;
+        };
+
+        PhaseTimers();
+
+        // Adds the frame that ends to the averages
+        void nextFrame();
+
+        // Seconds per frame, averaged over the last frames so the display can be read
+        double get(Phase) const;
+        // Seconds spent in the phase since the start, for the benchmarks
+        double getTotal(Phase) const;
+        static const char* name(Phase);
+
+    private:
+        void add(Phase, double seconds);
+
+        using Times = std::array<double, static_cast<size_t>(Phase::Count)>;
+        Times _frame;
+        Times _average;
+        Times _total;
+    };
+}
@@ -0,0 +1,230 @@
+#include "PhysicsChecks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+#include "ParticleManager.h"
+#include "Scene.h"
+
+using namespace std;
+
+namespace SPH
+{
+    PhysicsChecks::PhysicsChecks()
+        : _checks(0)
+        , _failures(0)
+    {}
+
+    int PhysicsChecks::run()
+    {
+        auto start = chrono::steady_clock::now();
+
+        damBreak();
+        restingTank();
+        droplet();
+        backends();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << _checks << " checks, " << _failures << " failed, in " << seconds << " s" << endl;
+        return _failures > 0 ? 1 : 0;
+    }
+
+    PhysicsChecks::Totals PhysicsChecks::measure(const vector<Particle>& particles, double ax, double ay)
+    {
+        Totals totals{};
+        totals.count = particles.size();
+        totals.finite = true;
+        totals.inside = true;
+
+        for (const Particle& p : particles)
+        {
+            double m = ParticleManager::MATERIALS[p.material].mass;
+            double speedSq = p.vx * p.vx + p.vy * p.vy;
+
+            totals.mass += m;
+            totals.px += m * p.vx;
+            totals.py += m * p.vy;
+            totals.kinetic += 0.5 * m * speedSq;
+            totals.potential -= m * (ax * p.x + ay * p.y);
+            totals.rmsSpeed += speedSq;
+
+            totals.finite = totals.finite && isfinite(p.x) && isfinite(p.y) && isfinite(p.vx) && isfinite(p.vy);
+            totals.inside = totals.inside && p.x >= 0 && p.x <= SCREEN_WIDTH && p.y >= 0 && p.y <= SCREEN_HEIGHT;
+        }
+
+        if (totals.count > 0)
+            totals.rmsSpeed = sqrt(totals.rmsSpeed / totals.count);
+        return totals;
+    }
+
+    void PhysicsChecks::expect(bool passed, const string& what, double value, double bound)
+    {
+        ++_checks;
+        _failures += !passed;
+        cout << (passed ? "pass  " : "FAIL  ") << what << ": " << value << " (bound " << bound << ")" << endl;
+    }
+
+    void PhysicsChecks::damBreak()
+    {
+        // Column of fluid against the left wall, falling to the right
+        Scene scene;
+        scene.seed = 1;
+        scene.gravity = DOWN;
+        scene.blocks.push_back({ 10, 230, 200, 470, 5, 0.2, 0 });
+
+        ParticleManager particleManager(1);
+        particleManager.loadScene(scene);
+
+        cdouble g = ParticleManager::GRAVITY;
+        Totals first = measure(particleManager.getParticles(), 0, g);
+        double energy = first.kinetic + first.potential;
+        double highest = energy;
+        bool finite = true, inside = true;
+
+        for (uint s{}; s < DAM_STEPS; ++s)
+        {
+            particleManager.update(FRAME_TIME);
+
+            Totals now = measure(particleManager.getParticles(), 0, g);
+            highest = std::max(highest, now.kinetic + now.potential);
+            finite = finite && now.finite;
+            inside = inside && now.inside;
+        }
+
+        Totals last = measure(particleManager.getParticles(), 0, g);
+        double end = last.kinetic + last.potential;
+
+        // The potential energy is taken from the top of the screen, the total is negative
+        double scale = fabs(energy);
+        expect(last.count == first.count, "dam break, particles kept", static_cast<double>(last.count), static_cast<double>(first.count));
+        expect(fabs(last.mass - first.mass) <= 1e-9 * first.mass, "dam break, mass change", last.mass - first.mass, 1e-9 * first.mass);
+        expect(finite, "dam break, finite values", finite, 1);
+        expect(inside, "dam break, inside the box", inside, 1);
+        expect(highest - energy <= ENERGY_GROWTH * scale, "dam break, energy growth / start",
+               (highest - energy) / scale, ENERGY_GROWTH);
+        expect(energy - end >= ENERGY_LOSS * scale, "dam break, energy loss / start", (energy - end) / scale, ENERGY_LOSS);
+    }
+
+    void PhysicsChecks::restingTank()
+    {
+        ParticleManager particleManager(1);
+        // Settled here, a cache left by another build would hide a change of the solver
+        particleManager.initSettledUncached(TANK_PARTICLES);
+
+        // The densities are computed by the first step, they are the reference of the others
+        auto densities = [&](double& mean, double& peak)
+        {
+            mean = peak = 0;
+            for (const Particle& p : particleManager.getParticles())
+            {
+                mean += p.rho;
+                peak = std::max(peak, p.rho);
+            }
+            mean /= std::max<size_t>(particleManager.getParticles().size(), 1);
+        };
+
+        particleManager.update(FRAME_TIME);
+        double startMean, startPeak;
+        densities(startMean, startPeak);
+
+        for (uint s{ 1 }; s < TANK_STEPS; ++s)
+            particleManager.update(FRAME_TIME);
+
+        double mean, peak;
+        densities(mean, peak);
+        Totals totals = measure(particleManager.getParticles(), 0, ParticleManager::GRAVITY);
+
+        expect(totals.count == TANK_PARTICLES, "resting tank, particles kept", static_cast<double>(totals.count), TANK_PARTICLES);
+        expect(totals.rmsSpeed <= REST_SPEED, "resting tank, rms speed", totals.rmsSpeed, REST_SPEED);
+        expect(fabs(mean / startMean - 1) <= DENSITY_DRIFT, "resting tank, mean density drift", mean / startMean - 1, DENSITY_DRIFT);
+        expect(peak / startPeak - 1 <= DENSITY_PEAK, "resting tank, peak density growth", peak / startPeak - 1, DENSITY_PEAK);
+    }
+
+    void PhysicsChecks::droplet()
+    {
+        // A square of fluid with surface tension in the middle of the screen,
+        // only the pairwise forces act on it until it reaches a wall
+        Scene scene;
+        scene.seed = 2;
+        scene.gravity = NO_GRAVITY;
+        scene.tension = true;
+        scene.blocks.push_back({ 320, 200, 400, 280, 4, 0.2, 0 });
+
+        ParticleManager particleManager(1);
+        particleManager.loadScene(scene);
+
+        double drift = 0;
+        uint away = 0;
+        for (uint s{}; s < DROPLET_STEPS; ++s)
+        {
+            particleManager.update(FRAME_TIME);
+
+            const vector<Particle>& particles = particleManager.getParticles();
+            bool touching = std::any_of(particles.begin(), particles.end(), [](const Particle& p)
+            {
+                return p.x < WALL_MARGIN || p.x > SCREEN_WIDTH - WALL_MARGIN
+                    || p.y < WALL_MARGIN || p.y > SCREEN_HEIGHT - WALL_MARGIN;
+            });
+            if (touching)
+                break;
+            ++away;
+
+            Totals totals = measure(particles, 0, 0);
+            double momentum = sqrt(totals.px * totals.px + totals.py * totals.py);
+            if (totals.rmsSpeed > 0)
+                drift = std::max(drift, momentum / (totals.mass * totals.rmsSpeed));
+        }
+
+        expect(away == DROPLET_STEPS, "droplet, steps away from the walls", away, DROPLET_STEPS);
+        expect(drift <= MOMENTUM_DRIFT, "droplet, momentum / (mass * rms speed)", drift, MOMENTUM_DRIFT);
+    }
+
+    void PhysicsChecks::backends()
+    {
+        Scene scene;
+        scene.seed = 3;
+        scene.gravity = DOWN;
+        scene.blocks.push_back({ 10, 230, 200, 470, 5, 0.2, 0 });
+
+        auto simulate = [&](uint threads, GridBackend backend)
+        {
+            auto particleManager = make_unique<ParticleManager>(threads);
+            particleManager->setGridBackend(backend);
+            particleManager->loadScene(scene);
+            for (uint s{}; s < BACKEND_STEPS; ++s)
+                particleManager->update(FRAME_TIME);
+            return particleManager;
+        };
+
+        // The scalar reference: one thread, the serial grid
+        auto reference = simulate(1, GridBackend::Serial);
+        const vector<Particle>& expected = reference->getParticles();
+
+        struct Variant
+        {
+            const char* name;
+            uint threads;
+            GridBackend backend;
+        };
+        const Variant variants[] = {
+            { "backends, threaded passes", BACKEND_THREADS, GridBackend::Serial },
+            { "backends, radix grid", 1, GridBackend::ParallelRadix },
+            { "backends, threaded radix grid", BACKEND_THREADS, GridBackend::ParallelRadix }
+        };
+
+        for (const Variant& variant : variants)
+        {
+            auto particleManager = simulate(variant.threads, variant.backend);
+            const vector<Particle>& particles = particleManager->getParticles();
+
+            double largest = particles.size() == expected.size() ? 0 : INFINITY;
+            for (size_t i{}; i < particles.size() && i < expected.size(); ++i)
+                largest = std::max(largest, std::hypot(particles[i].x - expected[i].x, particles[i].y - expected[i].y));
+
+            expect(largest <= BACKEND_TOLERANCE, string(variant.name) + ", largest distance", largest, BACKEND_TOLERANCE);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// Invariants of the 2D solver on a few canonical scenes, run from the command line
+// after a change to the density, force or integration passes:
+//
+//   fluid_simulation --check
+//
+// - dam break: no particle lost or out of the box, total energy never above the start and lower at the end
+// - resting tank: the settled fluid stays at rest and its density where the first step found it
+// - droplet: without gravity and away from the walls, the total momentum stays 0
+// - backends: the threaded and radix passes give the particles of the serial single thread run
+//
+// Each line tells the measured value and its bound, the exit code is 1 when one failed.
+
+#include <string>
+#include <vector>
+
+#include "Globals.h"
+#include "Particle.h"
+
+namespace SPH
+{
+    class ParticleManager;
+
+    class PhysicsChecks
+    {
+        using cdouble = const double;
+        using cuint = const uint;
+
+        inline static const float FRAME_TIME = 1.0f / 30; // as GameSPH at its target FPS
+        inline static cuint DAM_STEPS = 150;
+        inline static cuint TANK_PARTICLES = 2000;
+        inline static cuint TANK_STEPS = 60;
+        inline static cuint DROPLET_STEPS = 30;
+        inline static cdouble WALL_MARGIN = 16.0; // the kernel radius, the walls act on the particles closer
+        inline static cuint BACKEND_STEPS = 40;
+        inline static cuint BACKEND_THREADS = 4;
+
+        inline static cdouble ENERGY_GROWTH = 0.01;    // of the total energy, above its start
+        inline static cdouble ENERGY_LOSS = 0.05;      // at least, at the end of the dam break
+        inline static cdouble DENSITY_DRIFT = 0.05;    // of the mean density of the tank, from its first step
+        inline static cdouble DENSITY_PEAK = 0.2;      // growth of the largest density of the tank
+        inline static cdouble REST_SPEED = 100.0;      // rms speed of the tank, px/s
+        inline static cdouble MOMENTUM_DRIFT = 1e-9;   // of the momentum the droplet would have all moving at its rms speed
+        inline static cdouble BACKEND_TOLERANCE = 1e-6; // px, from the reference
+
+    public:
+        PhysicsChecks();
+
+        // Returns the exit code of the program
+        int run();
+
+    private:
+        struct Totals
+        {
+            size_t count;
+            double mass;
+            double px, py;        // momentum
+            double kinetic;
+            double potential;     // in the gravity (ax, ay)
+            double rmsSpeed;
+            bool finite;          // no NaN or infinity
+            bool inside;          // all in the screen
+        };
+
+        static Totals measure(const std::vector<Particle>&, double ax, double ay);
+        // Prints the check with the value and its bound, counts the failures
+        void expect(bool passed, const std::string& what, double value, double bound);
+
+        void damBreak();
+        void restingTank();
+        void droplet();
+        void backends();
+
+        uint _checks;
+        uint _failures;
+    };
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Memory use of the whole process, for the benchmarks.
+// Kept apart from raylib, whose names clash with the Windows headers.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SPH
+{
+    // Largest resident set of the process so far, in bytes, 0 where unknown.
+    // It never goes down, a run measures its own peak only if nothing larger ran before it.
+    size_t peakResidentBytes();
+
+    // Calls to operator new since the start, by any thread
+    uint64_t allocationCount();
+}
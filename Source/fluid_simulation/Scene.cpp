@@ -0,0 +1,144 @@
+#include "Scene.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "ParticleManager.h"
+
+namespace SPH
+{
+    namespace
+    {
+        bool readSwitch(std::istringstream& words, std::optional<bool>& value)
+        {
+            std::string word;
+            if (!(words >> word) || (word != "on" && word != "off"))
+                return false;
+
+            value = word == "on";
+            return true;
+        }
+
+        bool readMaterial(const std::string& name, uchar& material)
+        {
+            for (uint m{}; m < ParticleManager::NB_MATERIALS; ++m)
+                if (name == ParticleManager::MATERIALS[m].name)
+                {
+                    material = static_cast<uchar>(m);
+                    return true;
+                }
+
+            return false;
+        }
+
+        // The whole word, not its start
+        bool readNumber(const std::string& word, double& value)
+        {
+            std::istringstream number(word);
+            double read;
+            if (!(number >> read) || number.peek() != std::char_traits<char>::eof())
+                return false;
+
+            value = read;
+            return true;
+        }
+    }
+
+    bool Scene::parse(const std::string& text, std::string& error)
+    {
+        std::istringstream lines(text);
+        std::string line;
+
+        for (uint number{ 1 }; std::getline(lines, line); ++number)
+        {
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword))
+                continue;
+
+            bool valid = true;
+            std::string word;
+            double a, b, c, d, e, f;
+
+            if (keyword == "seed")
+                valid = static_cast<bool>(words >> seed);
+            else if (keyword == "domain")
+                valid = words >> width >> height && width > 0 && height > 0 && width <= SCREEN_WIDTH && height <= SCREEN_HEIGHT;
+            else if (keyword == "gravity" && words >> word)
+            {
+                if (word == "down") gravity = DOWN;
+                else if (word == "up") gravity = UP;
+                else if (word == "left") gravity = LEFT;
+                else if (word == "right") gravity = RIGHT;
+                else if (word == "none") gravity = NO_GRAVITY;
+                else valid = false;
+            }
+            else if (keyword == "integrator" && words >> word)
+            {
+                valid = word == "euler" || word == "leapfrog";
+                leapfrog = word == "leapfrog";
+            }
+            else if (keyword == "xsph" && words >> a)
+                xsph = a;
+            else if (keyword == "viscosity" && words >> a)
+                viscosity = a;
+            else if (keyword == "slowmotion" && words >> a && a > 0)
+                slowMotion = static_cast<float>(a);
+            else if (keyword == "tension")
+                valid = readSwitch(words, tension);
+            else if (keyword == "boundary")
+                valid = readSwitch(words, boundary);
+            else if (keyword == "obstacle_pressure")
+                valid = readSwitch(words, obstaclePressure);
+            else if (keyword == "sleeping")
+                valid = readSwitch(words, sleeping);
+            else if (keyword == "block" && words >> a >> b >> c >> d >> e && e > 0)
+            {
+                // The jitter may be left out before the material
+                Block block{ a, b, c, d, e, 0, 0 };
+                bool more = static_cast<bool>(words >> word);
+                if (more && readNumber(word, block.jitter))
+                    more = static_cast<bool>(words >> word);
+                if (more)
+                    valid = readMaterial(word, block.material);
+                blocks.push_back(block);
+            }
+            else if (keyword == "emitter" && words >> a >> b >> c >> d >> e >> f)
+                emitters.push_back({ a, b, c, d, e, f, 0 });
+            else if (keyword == "sink" && words >> a >> b >> c >> d)
+                sinks.push_back({ a, b, c, d });
+            else if (keyword == "circle" || keyword == "box" || keyword == "segment")
+            {
+                // Read now, so that a scene with a bad shape is not applied at all
+                valid = static_cast<bool>(SdfField::readShape(line));
+                obstacles += line + "\n";
+            }
+            else
+                valid = false;
+
+            if (!valid)
+            {
+                error = "line " + std::to_string(number) + ": " + line;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Scene::load(const std::string& fileName, std::string& error)
+    {
+        std::ifstream file(fileName);
+        if (!file)
+        {
+            error = "cannot open " + fileName;
+            return false;
+        }
+
+        std::stringstream text;
+        text << file.rdbuf();
+        return parse(text.str(), error);
+    }
+}
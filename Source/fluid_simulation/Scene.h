@@ -0,0 +1,63 @@
+#pragma once
+
+// Initial conditions of the 2D simulation, read from a text file so a run can be reproduced.
+// One declaration per line, in pixels, '#' starts a comment:
+//   seed 42                                   random numbers of the jitter and of the run
+//   domain width height                       the fluid stays in [0, width] x [0, height], at most the screen
+//   gravity down|up|left|right|none
+//   integrator euler|leapfrog
+//   xsph epsilon
+//   viscosity alpha                           artificial viscosity
+//   slowmotion factor
+//   tension|boundary|obstacle_pressure|sleeping on|off
+//   block left top right bottom spacing [jitter] [material]
+//                                             fluid on a square lattice, jitter in spacings
+//   emitter x y vx vy width rate
+//   sink left top right bottom
+//   circle|box|segment ...                    obstacles, see SdfField
+// Whatever a scene does not declare takes the value of a new simulation: gravity down, semi-implicit
+// Euler, no XSPH, artificial viscosity or tension, slow motion 10, and the options off.
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Globals.h"
+#include "Emitters.h"
+
+namespace SPH
+{
+    struct Scene
+    {
+        struct Block
+        {
+            double left, top, right, bottom;
+            double spacing;
+            double jitter;
+            uchar material;
+        };
+
+        uint seed = 0;
+        double width = SCREEN_WIDTH;
+        double height = SCREEN_HEIGHT;
+
+        std::optional<int> gravity;      // DOWN, UP, LEFT, RIGHT or NO_GRAVITY
+        std::optional<bool> leapfrog;
+        std::optional<double> xsph;
+        std::optional<double> viscosity;
+        std::optional<float> slowMotion;
+        std::optional<bool> tension;
+        std::optional<bool> boundary;
+        std::optional<bool> obstaclePressure;
+        std::optional<bool> sleeping;
+
+        std::vector<Block> blocks;
+        std::vector<Emitter> emitters;
+        std::vector<Sink> sinks;
+        std::string obstacles; // shape lines for SdfField::loadShapes
+
+        // On failure, error tells the line that could not be read
+        bool parse(const std::string& text, std::string& error);
+        bool load(const std::string& fileName, std::string& error);
+    };
+}
@@ -0,0 +1,329 @@
+#include "SdfField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <raylib.h>
+
+namespace SPH
+{
+    namespace
+    {
+        const double NO_FEATURE = 1e20;
+
+        // Squared distance transform of one line (Felzenszwalb and Huttenlocher),
+        // f is 0 on the features and NO_FEATURE elsewhere
+        void distanceTransform(const std::vector<double>& f, std::vector<double>& d,
+                               std::vector<int>& v, std::vector<double>& z)
+        {
+            int n = static_cast<int>(f.size());
+            int k = 0;
+            v[0] = 0;
+            z[0] = -NO_FEATURE;
+            z[1] = +NO_FEATURE;
+
+            for (int q{ 1 }; q < n; ++q)
+            {
+                double s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+                while (s <= z[k])
+                {
+                    --k;
+                    s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+                }
+                ++k;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = +NO_FEATURE;
+            }
+
+            k = 0;
+            for (int q{}; q < n; ++q)
+            {
+                while (z[k + 1] < q)
+                    ++k;
+                d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+            }
+        }
+
+        // Distance, in nodes, from every node to the closest feature node
+        std::vector<double> distanceToFeatures(const std::vector<bool>& features, int width, int height)
+        {
+            std::vector<double> grid(features.size());
+            for (size_t n{}; n < features.size(); ++n)
+                grid[n] = features[n] ? 0.0 : NO_FEATURE;
+
+            int size = std::max(width, height);
+            std::vector<double> f, d;
+            std::vector<int> v(size);
+            std::vector<double> z(size + 1);
+
+            // Columns then rows
+            f.resize(height);
+            d.resize(height);
+            for (int i{}; i < width; ++i)
+            {
+                for (int j{}; j < height; ++j)
+                    f[j] = grid[i + j * width];
+                distanceTransform(f, d, v, z);
+                for (int j{}; j < height; ++j)
+                    grid[i + j * width] = d[j];
+            }
+
+            f.resize(width);
+            d.resize(width);
+            for (int j{}; j < height; ++j)
+            {
+                for (int i{}; i < width; ++i)
+                    f[i] = grid[i + j * width];
+                distanceTransform(f, d, v, z);
+                for (int i{}; i < width; ++i)
+                    grid[i + j * width] = d[i];
+            }
+
+            for (double& g : grid)
+                g = sqrt(g);
+            return grid;
+        }
+    }
+
+    SdfField::SdfField()
+        : _nodes(NB_NODES_X * NB_NODES_Y, FAR)
+        , _empty(true)
+        , _dirty(false)
+        , _texture{}
+    {}
+
+    SdfField::~SdfField()
+    {
+        // Past CloseWindow the context is gone, and with it the texture
+        if (_texture.id != 0 && IsWindowReady())
+            UnloadTexture(_texture);
+    }
+
+    float& SdfField::node(int i, int j)
+    {
+        return _nodes[i + j * NB_NODES_X];
+    }
+
+    float SdfField::node(int i, int j) const
+    {
+        return _nodes[i + j * NB_NODES_X];
+    }
+
+    void SdfField::clear()
+    {
+        std::fill(_nodes.begin(), _nodes.end(), FAR);
+        _empty = true;
+        _dirty = true;
+    }
+
+    bool SdfField::isEmpty() const
+    {
+        return _empty;
+    }
+
+    uint64_t SdfField::fingerprint() const
+    {
+        // FNV-1a over the bytes of the nodes
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(_nodes.data());
+
+        for (size_t i{}; i < _nodes.size() * sizeof(float); ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+        return hash;
+    }
+
+    std::function<double(double, double)> SdfField::readShape(const std::string& line)
+    {
+        std::istringstream words(line);
+        std::string shape;
+        double a, b, c, d, e;
+
+        if (!(words >> shape))
+            return {};
+
+        if (shape == "circle" && words >> a >> b >> c)
+            return [=](double x, double y)
+            {
+                return hypot(x - a, y - b) - c;
+            };
+        if (shape == "box" && words >> a >> b >> c >> d)
+            return [=](double x, double y)
+            {
+                double qx = std::max(a - x, x - c);
+                double qy = std::max(b - y, y - d);
+                return hypot(std::max(qx, 0.0), std::max(qy, 0.0)) + std::min(std::max(qx, qy), 0.0);
+            };
+        if (shape == "segment" && words >> a >> b >> c >> d >> e)
+            return [=](double x, double y)
+            {
+                double dx = c - a, dy = d - b;
+                double lengthSq = dx * dx + dy * dy;
+                double t = lengthSq > 0 ? std::clamp(((x - a) * dx + (y - b) * dy) / lengthSq, 0.0, 1.0) : 0.0;
+                return hypot(x - (a + t * dx), y - (b + t * dy)) - e * 0.5;
+            };
+
+        return {};
+    }
+
+    bool SdfField::loadShapes(const std::string& description)
+    {
+        clear();
+
+        bool valid = true;
+        std::istringstream lines(description);
+        std::string line;
+
+        while (std::getline(lines, line))
+        {
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream words(line);
+            std::string shape;
+            if (!(words >> shape))
+                continue;
+
+            std::function<double(double, double)> distanceTo = readShape(line);
+            if (!distanceTo)
+            {
+                valid = false;
+                continue;
+            }
+
+            // Union of the shapes
+            for (int j{}; j < NB_NODES_Y; ++j)
+                for (int i{}; i < NB_NODES_X; ++i)
+                {
+                    double dist = distanceTo(i * NODE_SPACING, j * NODE_SPACING);
+                    node(i, j) = std::min(node(i, j), static_cast<float>(dist));
+                }
+            _empty = false;
+        }
+
+        return valid;
+    }
+
+    bool SdfField::loadMask(const std::string& fileName)
+    {
+        Image image = LoadImage(fileName.c_str());
+        if (image.data == nullptr)
+            return false;
+
+        Color* pixels = LoadImageColors(image);
+
+        std::vector<bool> solid(_nodes.size());
+        for (int j{}; j < NB_NODES_Y; ++j)
+            for (int i{}; i < NB_NODES_X; ++i)
+            {
+                int px = std::min(i * NODE_SPACING * image.width / SCREEN_WIDTH, image.width - 1);
+                int py = std::min(j * NODE_SPACING * image.height / SCREEN_HEIGHT, image.height - 1);
+                const Color& c = pixels[px + py * image.width];
+
+                solid[i + j * NB_NODES_X] = c.a > 127 && (c.r + c.g + c.b) < 3 * 128;
+            }
+
+        UnloadImageColors(pixels);
+        UnloadImage(image);
+
+        bakeMask(solid);
+        return true;
+    }
+
+    void SdfField::bakeMask(const std::vector<bool>& solid)
+    {
+        clear();
+
+        if (std::find(solid.begin(), solid.end(), true) == solid.end())
+            return;
+
+        std::vector<bool> free(solid.size());
+        for (size_t n{}; n < solid.size(); ++n)
+            free[n] = !solid[n];
+
+        std::vector<double> outside = distanceToFeatures(solid, NB_NODES_X, NB_NODES_Y);
+        std::vector<double> inside = distanceToFeatures(free, NB_NODES_X, NB_NODES_Y);
+
+        // The surface lies half way between a solid node and a free one
+        for (size_t n{}; n < _nodes.size(); ++n)
+        {
+            double dist = solid[n] ? -(inside[n] - 0.5) : outside[n] - 0.5;
+            _nodes[n] = static_cast<float>(std::clamp(dist * NODE_SPACING, -double(FAR), double(FAR)));
+        }
+        _empty = false;
+    }
+
+    void SdfField::locate(double x, double y, int& i, int& j, double& tx, double& ty) const
+    {
+        double fx = std::clamp(x, 0.0, double(SCREEN_WIDTH)) / NODE_SPACING;
+        double fy = std::clamp(y, 0.0, double(SCREEN_HEIGHT)) / NODE_SPACING;
+
+        i = std::min(static_cast<int>(fx), NB_NODES_X - 2);
+        j = std::min(static_cast<int>(fy), NB_NODES_Y - 2);
+        tx = fx - i;
+        ty = fy - j;
+    }
+
+    double SdfField::distance(double x, double y) const
+    {
+        int i, j;
+        double tx, ty;
+        locate(x, y, i, j, tx, ty);
+
+        double top = node(i, j) + (node(i + 1, j) - node(i, j)) * tx;
+        double bottom = node(i, j + 1) + (node(i + 1, j + 1) - node(i, j + 1)) * tx;
+        return top + (bottom - top) * ty;
+    }
+
+    double SdfField::sample(double x, double y, double& gx, double& gy) const
+    {
+        int i, j;
+        double tx, ty;
+        locate(x, y, i, j, tx, ty);
+
+        double d00 = node(i, j), d10 = node(i + 1, j);
+        double d01 = node(i, j + 1), d11 = node(i + 1, j + 1);
+
+        // Derivatives of the bilinear interpolation
+        gx = ((d10 - d00) * (1 - ty) + (d11 - d01) * ty) / NODE_SPACING;
+        gy = ((d01 - d00) * (1 - tx) + (d11 - d10) * tx) / NODE_SPACING;
+
+        double top = d00 + (d10 - d00) * tx;
+        double bottom = d01 + (d11 - d01) * tx;
+        return top + (bottom - top) * ty;
+    }
+
+    void SdfField::render()
+    {
+        if (_dirty)
+        {
+            if (_texture.id != 0)
+                UnloadTexture(_texture);
+            _texture = {};
+
+            if (!_empty)
+            {
+                Image image = GenImageColor(NB_NODES_X, NB_NODES_Y, BLANK);
+                for (int j{}; j < NB_NODES_Y; ++j)
+                    for (int i{}; i < NB_NODES_X; ++i)
+                        if (node(i, j) < 0)
+                            ImageDrawPixel(&image, i, j, obstacleColor);
+
+                _texture = LoadTextureFromImage(image);
+                SetTextureFilter(_texture, TEXTURE_FILTER_BILINEAR);
+                UnloadImage(image);
+            }
+            _dirty = false;
+        }
+
+        if (_texture.id == 0)
+            return;
+
+        // Texel centers on the nodes
+        Rectangle source{ 0, 0, (float)NB_NODES_X, (float)NB_NODES_Y };
+        Rectangle dest{ -NODE_SPACING * 0.5f, -NODE_SPACING * 0.5f,
+                        (float)NB_NODES_X * NODE_SPACING, (float)NB_NODES_Y * NODE_SPACING };
+        DrawTexturePro(_texture, source, dest, Vector2{}, 0, WHITE);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <raylib.h>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    // Signed distance to static obstacles, negative inside them.
+    // Baked once on a regular grid of nodes over the screen and sampled bilinearly,
+    // so a lookup costs the same whatever the obstacles are made of.
+    class SdfField
+    {
+        using cint = const int;
+        using cfloat = const float;
+
+        inline static cint NODE_SPACING = 4; // pixels between two nodes
+        inline static cint NB_NODES_X = SCREEN_WIDTH / NODE_SPACING + 1;
+        inline static cint NB_NODES_Y = SCREEN_HEIGHT / NODE_SPACING + 1;
+        inline static cfloat FAR = static_cast<float>(SCREEN_WIDTH + SCREEN_HEIGHT); // no obstacle around
+
+        const Color obstacleColor{ 90, 90, 90, 255 };
+
+    public:
+        SdfField();
+        ~SdfField();
+
+        SdfField(const SdfField&) = delete;
+        SdfField& operator=(const SdfField&) = delete;
+
+        void clear();
+        bool isEmpty() const;
+        // Hash of the baked field, equal for equal obstacles
+        uint64_t fingerprint() const;
+
+        // One shape per line, in pixels, '#' starts a comment:
+        //   circle x y radius
+        //   box left top right bottom
+        //   segment x0 y0 x1 y1 thickness
+        // Returns false if a line could not be read, the other shapes are kept.
+        bool loadShapes(const std::string& description);
+        // Distance to the shape of one line without its comment, empty if the line cannot be read
+        static std::function<double(double, double)> readShape(const std::string& line);
+
+        // Dark opaque pixels of the image are solid, the image is stretched over the screen
+        bool loadMask(const std::string& fileName);
+
+        double distance(double x, double y) const;
+        // Distance and its gradient, which points away from the obstacles
+        double sample(double x, double y, double& gx, double& gy) const;
+
+        void render();
+
+    private:
+        float& node(int i, int j);
+        float node(int i, int j) const;
+
+        void bakeMask(const std::vector<bool>& solid);
+        void locate(double x, double y, int& i, int& j, double& tx, double& ty) const;
+
+        std::vector<float> _nodes;
+        bool _empty;
+
+        // Drawn from a texture made when the field changes, uploaded lazily since the
+        // field can be loaded before the window exists
+        bool _dirty;
+        Texture2D _texture;
+    };
+}
@@ -0,0 +1,123 @@
+#include "SocketTransport.h"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace SPH
+{
+    namespace
+    {
+        void fail(const char* what, uint peer)
+        {
+            cout << "rank transport: " << what << " rank " << peer << " failed" << endl;
+            exit(1);
+        }
+
+        // Whole buffers, a stream socket can take or give less than asked
+        bool writeAll(int socket, const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t done = write(socket, data, size);
+                if (done < 0 && errno == EINTR)
+                    continue;
+                if (done <= 0)
+                    return false;
+                data += done;
+                size -= done;
+            }
+            return true;
+        }
+
+        bool readAll(int socket, char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t done = read(socket, data, size);
+                if (done < 0 && errno == EINTR)
+                    continue;
+                if (done <= 0)
+                    return false;
+                data += done;
+                size -= done;
+            }
+            return true;
+        }
+    }
+
+    bool SocketTransport::connectAll(uint ranks, Sockets& sockets)
+    {
+        sockets.assign(ranks, vector<int>(ranks, -1));
+
+        for (uint a{}; a < ranks; ++a)
+            for (uint b{ a + 1 }; b < ranks; ++b)
+            {
+                int pair[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+                    return false;
+                sockets[a][b] = pair[0];
+                sockets[b][a] = pair[1];
+            }
+
+        return true;
+    }
+
+    SocketTransport::SocketTransport(const Sockets& sockets, uint rank)
+        : _sockets(sockets[rank])
+        , _rank(rank)
+    {
+        for (uint a{}; a < sockets.size(); ++a)
+            for (int socket : sockets[a])
+                if (a != rank && socket >= 0)
+                    close(socket);
+    }
+
+    SocketTransport::~SocketTransport()
+    {
+        for (int socket : _sockets)
+            if (socket >= 0)
+                close(socket);
+    }
+
+    uint SocketTransport::rank() const
+    {
+        return _rank;
+    }
+
+    uint SocketTransport::size() const
+    {
+        return static_cast<uint>(_sockets.size());
+    }
+
+    void SocketTransport::send(uint to, const Bytes& message)
+    {
+        // The size first, the stream does not keep the bounds of the messages
+        uint64_t size = message.size();
+        if (!writeAll(_sockets[to], reinterpret_cast<const char*>(&size), sizeof(size))
+            || !writeAll(_sockets[to], message.data(), message.size()))
+            fail("sending to", to);
+    }
+
+    Transport::Bytes SocketTransport::receive(uint from)
+    {
+        uint64_t size;
+        if (!readAll(_sockets[from], reinterpret_cast<char*>(&size), sizeof(size)))
+            fail("receiving from", from);
+
+        Bytes message(size);
+        if (!readAll(_sockets[from], message.data(), message.size()))
+            fail("receiving from", from);
+        return message;
+    }
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+// Ranks running as processes of one machine, connected by Unix domain sockets,
+// the stand-in for the interconnect of a cluster. Not available on Windows.
+
+#ifndef _WIN32
+
+#include <vector>
+
+#include "Transport.h"
+
+namespace SPH
+{
+    class SocketTransport final : public Transport
+    {
+    public:
+        // A connected pair of sockets for every two ranks, created before the processes split:
+        // sockets[a][b] is the end of rank a towards rank b, -1 for a rank and itself
+        using Sockets = std::vector<std::vector<int>>;
+        static bool connectAll(uint ranks, Sockets&);
+
+        // In the process of the rank, keeps its ends and closes the others
+        SocketTransport(const Sockets&, uint rank);
+        ~SocketTransport();
+
+        SocketTransport(const SocketTransport&) = delete;
+        SocketTransport& operator=(const SocketTransport&) = delete;
+
+        uint rank() const override;
+        uint size() const override;
+        // A rank whose peer is gone cannot go on, the process ends
+        void send(uint to, const Bytes&) override;
+        Bytes receive(uint from) override;
+
+    private:
+        std::vector<int> _sockets; // towards each rank
+        uint _rank;
+    };
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "SoftwareRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ThreadPool.h"
+
+namespace SPH
+{
+    namespace
+    {
+        // First pixel whose center is at or after the coordinate
+        int firstPixel(float coordinate)
+        {
+            return static_cast<int>(ceil(coordinate - 0.5f));
+        }
+
+        // src over dst, like glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on an 8 bits target
+        unsigned char blend(unsigned char src, unsigned char dst, int alpha)
+        {
+            return static_cast<unsigned char>((src * alpha + dst * (255 - alpha) + 127) / 255);
+        }
+    }
+
+    SoftwareRenderer::SoftwareRenderer()
+        : _pixels(SCREEN_WIDTH * SCREEN_HEIGHT)
+    {}
+
+    void SoftwareRenderer::clear(Color color)
+    {
+        std::fill(_pixels.begin(), _pixels.end(), color);
+    }
+
+    void SoftwareRenderer::draw(const std::vector<Quad>& quads, ThreadPool& workers)
+    {
+        workers.parallelFor(SCREEN_HEIGHT, [&](uint begin, uint end, uint)
+        {
+            for (const Quad& q : quads)
+            {
+                // Pixels whose center is inside the rectangle, clipped to the rows of this worker
+                int x0 = std::max(firstPixel(q.rect.x), 0);
+                int x1 = std::min(firstPixel(q.rect.x + q.rect.width), SCREEN_WIDTH);
+                int y0 = std::max(firstPixel(q.rect.y), static_cast<int>(begin));
+                int y1 = std::min(firstPixel(q.rect.y + q.rect.height), static_cast<int>(end));
+
+                // The image stays opaque, as the window does
+                for (int y{ y0 }; y < y1; ++y)
+                    for (int x{ x0 }; x < x1; ++x)
+                    {
+                        Color& dst = _pixels[x + y * SCREEN_WIDTH];
+                        dst.r = blend(q.color.r, dst.r, q.color.a);
+                        dst.g = blend(q.color.g, dst.g, q.color.a);
+                        dst.b = blend(q.color.b, dst.b, q.color.a);
+                    }
+            }
+        });
+    }
+
+    bool SoftwareRenderer::save(const std::string& fileName) const
+    {
+        Image image{ const_cast<Color*>(_pixels.data()), SCREEN_WIDTH, SCREEN_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        return ExportImage(image, fileName.c_str());
+    }
+
+    Image SoftwareRenderer::copy() const
+    {
+        Image image{ const_cast<Color*>(_pixels.data()), SCREEN_WIDTH, SCREEN_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        return ImageCopy(image);
+    }
+}
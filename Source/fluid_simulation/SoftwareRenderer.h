@@ -0,0 +1,42 @@
+#pragma once
+
+// Draws the 2D views on the CPU into an RGBA buffer, for runs without a GPU or a window.
+// It blends the same rectangles renderParticles and renderCells send to raylib,
+// with the coverage and blending rules of the GPU, so a saved image looks like the window.
+
+#include <vector>
+#include <string>
+#include <raylib.h>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    class ThreadPool;
+
+    // Filled rectangle drawn with alpha blending
+    struct Quad
+    {
+        Rectangle rect;
+        Color color;
+    };
+
+    class SoftwareRenderer
+    {
+    public:
+        SoftwareRenderer();
+
+        void clear(Color);
+
+        // Rows are split between the workers, each one blends every quad in order over its rows
+        void draw(const std::vector<Quad>&, ThreadPool&);
+
+        // PNG or QOI, from the extension of the file name
+        bool save(const std::string& fileName) const;
+        // Copy of the buffer, top row first, to unload with UnloadImage
+        Image copy() const;
+
+    private:
+        std::vector<Color> _pixels;
+    };
+}
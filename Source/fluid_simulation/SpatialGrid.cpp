@@ -0,0 +1,193 @@
+#include "SpatialGrid.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "ThreadPool.h"
+
+namespace SPH
+{
+    template <int DIM>
+    BasicSpatialGrid<DIM>::BasicSpatialGrid()
+        : _backend(GridBackend::Serial)
+        , _cellStart(Shape::NB_CELLS)
+        , _cellEnd(Shape::NB_CELLS)
+    {}
+
+    template <int DIM>
+    GridBackend BasicSpatialGrid<DIM>::getBackend() const
+    {
+        return _backend;
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::setBackend(GridBackend backend)
+    {
+        _backend = backend;
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::build(const std::vector<BasicParticle<DIM>>& particles, ThreadPool& pool)
+    {
+        _keys.resize(particles.size());
+        _sorted.resize(particles.size());
+
+        if (_backend == GridBackend::ParallelRadix)
+            buildParallel(particles, pool);
+        else
+            buildSerial(particles);
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::buildSerial(const std::vector<BasicParticle<DIM>>& particles)
+    {
+        uint n = static_cast<uint>(particles.size());
+        _keysTmp.resize(n);
+
+        // Count particles per cell
+        std::fill(_cellEnd.begin(), _cellEnd.end(), 0);
+        for (uint i{}; i < n; ++i)
+        {
+            uint key = Shape::cellOf(particles[i]);
+            _keysTmp[i] = key;
+            ++_cellEnd[key];
+        }
+
+        // Exclusive prefix sum, _cellEnd is then used as the write cursor of each cell
+        uint offset = 0;
+        for (uint c{}; c < Shape::NB_CELLS; ++c)
+        {
+            uint nb = _cellEnd[c];
+            _cellStart[c] = offset;
+            _cellEnd[c] = offset;
+            offset += nb;
+        }
+
+        for (uint i{}; i < n; ++i)
+        {
+            uint key = _keysTmp[i];
+            uint pos = _cellEnd[key]++;
+            _keys[pos] = key;
+            _sorted[pos] = i;
+        }
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::buildParallel(const std::vector<BasicParticle<DIM>>& particles, ThreadPool& pool)
+    {
+        uint n = static_cast<uint>(particles.size());
+        _keysTmp.resize(n);
+        _sortedTmp.resize(n);
+
+        pool.parallelFor(n, [&](uint begin, uint end, uint)
+        {
+            for (uint i{ begin }; i < end; ++i)
+            {
+                _keys[i] = Shape::cellOf(particles[i]);
+                _sorted[i] = i;
+            }
+        });
+
+        // LSD radix sort, as many passes as the cell ids need digits
+        for (uint shift{}; ((Shape::NB_CELLS - 1) >> shift) != 0; shift += RADIX_BITS)
+            radixPass(shift, pool);
+
+        findCellRanges(pool);
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::radixPass(uint shift, ThreadPool& pool)
+    {
+        uint n = static_cast<uint>(_keys.size());
+        uint nbWorkers = pool.size();
+
+        _histograms.assign(nbWorkers * RADIX, 0);
+        _sliceTotals.assign(nbWorkers, 0);
+
+        // Per worker histogram of the digit
+        pool.parallelFor(n, [&](uint begin, uint end, uint worker)
+        {
+            uint* histogram = &_histograms[worker * RADIX];
+            for (uint i{ begin }; i < end; ++i)
+                ++histogram[(_keys[i] >> shift) & (RADIX - 1)];
+        });
+
+        // Exclusive prefix sum over (digit, worker) in digit major order, which keeps the sort stable:
+        // every worker scans a slice of the digits, then the slice totals are scanned and added back.
+        pool.parallelFor(RADIX, [&](uint begin, uint end, uint worker)
+        {
+            uint sum = 0;
+            for (uint d{ begin }; d < end; ++d)
+                for (uint w{}; w < nbWorkers; ++w)
+                {
+                    uint& entry = _histograms[w * RADIX + d];
+                    uint nb = entry;
+                    entry = sum;
+                    sum += nb;
+                }
+            _sliceTotals[worker] = sum;
+        });
+
+        uint offset = 0;
+        for (uint& total : _sliceTotals)
+        {
+            uint nb = total;
+            total = offset;
+            offset += nb;
+        }
+
+        pool.parallelFor(RADIX, [&](uint begin, uint end, uint worker)
+        {
+            uint base = _sliceTotals[worker];
+            for (uint d{ begin }; d < end; ++d)
+                for (uint w{}; w < nbWorkers; ++w)
+                    _histograms[w * RADIX + d] += base;
+        });
+
+        // Scatter, each worker walks the same chunk it counted
+        pool.parallelFor(n, [&](uint begin, uint end, uint worker)
+        {
+            uint* offsets = &_histograms[worker * RADIX];
+            for (uint i{ begin }; i < end; ++i)
+            {
+                uint pos = offsets[(_keys[i] >> shift) & (RADIX - 1)]++;
+                _keysTmp[pos] = _keys[i];
+                _sortedTmp[pos] = _sorted[i];
+            }
+        });
+
+        std::swap(_keys, _keysTmp);
+        std::swap(_sorted, _sortedTmp);
+    }
+
+    template <int DIM>
+    void BasicSpatialGrid<DIM>::findCellRanges(ThreadPool& pool)
+    {
+        uint n = static_cast<uint>(_keys.size());
+
+        pool.parallelFor(Shape::NB_CELLS, [&](uint begin, uint end, uint)
+        {
+            for (uint c{ begin }; c < end; ++c)
+            {
+                _cellStart[c] = 0;
+                _cellEnd[c] = 0;
+            }
+        });
+
+        // A cell starts where the sorted key changes
+        pool.parallelFor(n, [&](uint begin, uint end, uint)
+        {
+            for (uint i{ begin }; i < end; ++i)
+            {
+                uint key = _keys[i];
+                if (i == 0 || _keys[i - 1] != key)
+                    _cellStart[key] = i;
+                if (i + 1 == n || _keys[i + 1] != key)
+                    _cellEnd[key] = i + 1;
+            }
+        });
+    }
+
+    template class BasicSpatialGrid<2>;
+    template class BasicSpatialGrid<3>;
+}
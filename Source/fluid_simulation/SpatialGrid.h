@@ -0,0 +1,181 @@
+#pragma once
+
+#include <vector>
+
+#include "Globals.h"
+#include "Particle.h"
+
+namespace SPH
+{
+    class ThreadPool;
+
+    enum class GridBackend
+    {
+        Serial,         // single threaded counting sort
+        ParallelRadix   // per-thread histograms, parallel prefix sum and scatter
+    };
+
+    // Cells of the side of the kernel radius covering the simulated area
+    template <int DIM>
+    struct GridShape;
+
+    template <>
+    struct GridShape<2>
+    {
+        using cint = const int;
+
+        inline static cint BDH = 4; // log2 of the cell size
+        inline static cint CEll_SIZE = 1 << BDH;
+        inline static cint ROW_SIZE = SCREEN_WIDTH >> BDH;
+        inline static cint COL_SIZE = SCREEN_HEIGHT >> BDH;
+        inline static cint NB_CELLS = ROW_SIZE * COL_SIZE;
+        inline static cint NB_NEIGHBOUR_CELLS = 9;
+
+        static uint refX(const Particle& p) { return (static_cast<uint>(p.x) >> BDH) % (ROW_SIZE); }
+        static uint refY(const Particle& p) { return (static_cast<uint>(p.y) >> BDH) % (COL_SIZE); }
+
+        static uint cellId(uint x, uint y) { return x + y * ROW_SIZE; }
+        static uint cellOf(const Particle& p) { return cellId(refX(p), refY(p)); }
+
+        // Call f with the id of the 3x3 cells around (x, y) that are inside the grid
+        template <typename F>
+        static void forEachNeighbourCell(int x, int y, F&& f)
+        {
+            for (int nearX = x - 1; nearX <= x + 1; ++nearX)
+            {
+                if (nearX < 0 || nearX >= ROW_SIZE)
+                    continue;
+
+                for (int nearY = y - 1; nearY <= y + 1; ++nearY)
+                {
+                    if (nearY < 0 || nearY >= COL_SIZE)
+                        continue;
+
+                    f(cellId(nearX, nearY));
+                }
+            }
+        }
+    };
+
+    template <>
+    struct GridShape<3>
+    {
+        using cint = const int;
+
+        inline static cint BDH = 4; // log2 of the cell size
+        inline static cint CEll_SIZE = 1 << BDH;
+        inline static cint ROW_SIZE = SCREEN_WIDTH >> BDH;
+        inline static cint COL_SIZE = SCREEN_HEIGHT >> BDH;
+        inline static cint LAYER_SIZE = SCREEN_DEPTH >> BDH;
+        inline static cint NB_CELLS = ROW_SIZE * COL_SIZE * LAYER_SIZE;
+        inline static cint NB_NEIGHBOUR_CELLS = 27;
+
+        static uint refX(const Particle3D& p) { return (static_cast<uint>(p.x) >> BDH) % (ROW_SIZE); }
+        static uint refY(const Particle3D& p) { return (static_cast<uint>(p.y) >> BDH) % (COL_SIZE); }
+        static uint refZ(const Particle3D& p) { return (static_cast<uint>(p.z) >> BDH) % (LAYER_SIZE); }
+
+        static uint cellId(uint x, uint y, uint z) { return x + (y + z * COL_SIZE) * ROW_SIZE; }
+        static uint cellOf(const Particle3D& p) { return cellId(refX(p), refY(p), refZ(p)); }
+
+        // Call f with the id of the 3x3x3 cells around (x, y, z) that are inside the grid
+        template <typename F>
+        static void forEachNeighbourCell(int x, int y, int z, F&& f)
+        {
+            for (int nearX = x - 1; nearX <= x + 1; ++nearX)
+            {
+                if (nearX < 0 || nearX >= ROW_SIZE)
+                    continue;
+
+                for (int nearY = y - 1; nearY <= y + 1; ++nearY)
+                {
+                    if (nearY < 0 || nearY >= COL_SIZE)
+                        continue;
+
+                    for (int nearZ = z - 1; nearZ <= z + 1; ++nearZ)
+                    {
+                        if (nearZ < 0 || nearZ >= LAYER_SIZE)
+                            continue;
+
+                        f(cellId(nearX, nearY, nearZ));
+                    }
+                }
+            }
+        }
+    };
+
+    // Cell index of the particles: particle indices sorted by cell, and for each cell
+    // the [start, end) range it owns in that sorted list.
+    // Both backends are stable sorts, so a cell lists its particles in the same order
+    // as the particle array whatever the backend.
+    template <int DIM>
+    class BasicSpatialGrid
+    {
+        using cint = const int;
+
+    public:
+        using Shape = GridShape<DIM>;
+
+        // Sorted particle indices of one cell, usable in a range-for
+        struct Range
+        {
+            const uint* first;
+            const uint* last;
+
+            const uint* begin() const { return first; }
+            const uint* end() const { return last; }
+            uint size() const { return static_cast<uint>(last - first); }
+        };
+
+        BasicSpatialGrid();
+
+        void build(const std::vector<BasicParticle<DIM>>&, ThreadPool&);
+
+        GridBackend getBackend() const;
+        void setBackend(GridBackend);
+
+        Range cell(uint id) const
+        {
+            return { _sorted.data() + _cellStart[id], _sorted.data() + _cellEnd[id] };
+        }
+
+        uint count(uint id) const
+        {
+            return _cellEnd[id] - _cellStart[id];
+        }
+
+        // Particles in the cells around the given cell coordinates, the candidates of a neighbour search
+        template <typename... Coords>
+        uint stencilCount(Coords... coords) const
+        {
+            uint nb = 0;
+            Shape::forEachNeighbourCell(coords..., [&](uint id) { nb += count(id); });
+            return nb;
+        }
+
+    private:
+        // Digits of the parallel radix sort
+        inline static cint RADIX_BITS = 8;
+        inline static cint RADIX = 1 << RADIX_BITS;
+
+        void buildSerial(const std::vector<BasicParticle<DIM>>&);
+        void buildParallel(const std::vector<BasicParticle<DIM>>&, ThreadPool&);
+        void radixPass(uint shift, ThreadPool&);
+        void findCellRanges(ThreadPool&);
+
+        GridBackend _backend;
+
+        std::vector<uint> _keys;    // cell id of each sorted entry
+        std::vector<uint> _sorted;  // particle indices sorted by cell
+        std::vector<uint> _cellStart;
+        std::vector<uint> _cellEnd;
+
+        // Parallel backend scratch
+        std::vector<uint> _keysTmp;
+        std::vector<uint> _sortedTmp;
+        std::vector<uint> _histograms;  // RADIX entries per worker, then per worker offsets
+        std::vector<uint> _sliceTotals; // one per worker, for the prefix sum
+    };
+
+    using SpatialGrid = BasicSpatialGrid<2>;
+    using SpatialGrid3D = BasicSpatialGrid<3>;
+}
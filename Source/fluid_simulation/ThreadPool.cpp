@@ -0,0 +1,191 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace SPH
+{
+    ThreadPool::ThreadPool(uint nbWorkers)
+        : _queues(std::max(nbWorkers, 1u))
+        , _busyTimes(std::max(nbWorkers, 1u))
+        , _steals(0)
+        , _job(nullptr)
+        , _generation(0)
+        , _pending(0)
+        , _stop(false)
+    {
+        nbWorkers = std::max(nbWorkers, 1u);
+
+        _threads.reserve(nbWorkers - 1);
+        for (uint i{ 1 }; i < nbWorkers; ++i)
+            _threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+
+        for (std::thread& t : _threads)
+            t.join();
+    }
+
+    uint ThreadPool::size() const
+    {
+        return static_cast<uint>(_threads.size()) + 1;
+    }
+
+    void ThreadPool::chunk(uint count, uint nbChunks, uint index, uint& begin, uint& end)
+    {
+        uint base = count / nbChunks;
+        uint extra = count % nbChunks;
+
+        begin = index * base + std::min(index, extra);
+        end = begin + base + (index < extra ? 1 : 0);
+    }
+
+    void ThreadPool::parallelFor(uint count, const RangeTask& task)
+    {
+        uint nbWorkers = size();
+
+        dispatch([&](uint worker)
+        {
+            uint begin, end;
+            chunk(count, nbWorkers, worker, begin, end);
+            task(begin, end, worker);
+        });
+    }
+
+    void ThreadPool::runTasks(const std::vector<uint>& weights, const IndexTask& task)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        uint nbWorkers = size();
+        uint nbTasks = static_cast<uint>(weights.size());
+
+        // Seed the deques with contiguous runs of equal weight, so neighbouring cells stay on one worker
+        double total = 0;
+        for (uint w : weights)
+            total += w;
+
+        double run = 0;
+        uint owner = 0;
+        for (uint t{}; t < nbTasks; ++t)
+        {
+            _queues[owner].tasks.push_back(t);
+            run += weights[t];
+            while (owner + 1 < nbWorkers && run >= total * (owner + 1) / nbWorkers)
+                ++owner;
+        }
+
+        std::fill(_busyTimes.begin(), _busyTimes.end(), 0.0);
+        _steals = 0;
+
+        dispatch([&](uint worker)
+        {
+            double busy = 0;
+            uint t;
+            while (popOwn(worker, t) || steal(worker, t))
+            {
+                auto start = Clock::now();
+                task(t, worker);
+                busy += std::chrono::duration<double>(Clock::now() - start).count();
+            }
+            _busyTimes[worker] = busy;
+        });
+    }
+
+    const std::vector<double>& ThreadPool::getBusyTimes() const
+    {
+        return _busyTimes;
+    }
+
+    uint ThreadPool::getStealCount() const
+    {
+        return _steals;
+    }
+
+    bool ThreadPool::popOwn(uint worker, uint& task)
+    {
+        WorkerQueue& queue = _queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (queue.tasks.empty())
+            return false;
+
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool ThreadPool::steal(uint worker, uint& task)
+    {
+        uint nbWorkers = size();
+
+        for (uint i{ 1 }; i < nbWorkers; ++i)
+        {
+            WorkerQueue& victim = _queues[(worker + i) % nbWorkers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (victim.tasks.empty())
+                continue;
+
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            ++_steals;
+            return true;
+        }
+
+        return false;
+    }
+
+    void ThreadPool::dispatch(const std::function<void(uint)>& job)
+    {
+        if (_threads.empty())
+        {
+            job(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _pending = static_cast<uint>(_threads.size());
+            ++_generation;
+        }
+        _wake.notify_all();
+
+        job(0);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending == 0; });
+        _job = nullptr;
+    }
+
+    void ThreadPool::workerLoop(uint worker)
+    {
+        uint seen = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _stop || _generation != seen; });
+                if (_stop)
+                    return;
+                seen = _generation;
+            }
+
+            (*_job)(worker);
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                --_pending;
+            }
+            _done.notify_one();
+        }
+    }
+}
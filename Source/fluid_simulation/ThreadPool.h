@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    // Fixed set of worker threads running fork-join loops.
+    // The calling thread takes part in the work as worker 0.
+    class ThreadPool
+    {
+    public:
+        // begin, end, worker index
+        using RangeTask = std::function<void(uint, uint, uint)>;
+        // task index, worker index
+        using IndexTask = std::function<void(uint, uint)>;
+
+        explicit ThreadPool(uint nbWorkers = std::thread::hardware_concurrency());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        uint size() const;
+
+        // Split [0, count) in size() contiguous chunks, one per worker, and wait for all of them.
+        // The split only depends on count and size(), so two calls with the same count
+        // give every worker the same chunk.
+        void parallelFor(uint count, const RangeTask& task);
+
+        // Run weights.size() tasks with work stealing and wait for all of them.
+        // Each worker deque is seeded with a contiguous run of tasks of about the same total weight;
+        // a worker pops its own tasks in order and steals from the back of the others once it runs dry.
+        void runTasks(const std::vector<uint>& weights, const IndexTask& task);
+
+        // Seconds each worker spent running tasks during the last runTasks
+        const std::vector<double>& getBusyTimes() const;
+        // Tasks taken from another worker deque during the last runTasks
+        uint getStealCount() const;
+
+        static void chunk(uint count, uint nbChunks, uint index, uint& begin, uint& end);
+
+    private:
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<uint> tasks;
+        };
+
+        void dispatch(const std::function<void(uint)>& job);
+        void workerLoop(uint worker);
+
+        bool popOwn(uint worker, uint& task);
+        bool steal(uint worker, uint& task);
+
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+
+        std::vector<WorkerQueue> _queues;
+        std::vector<double> _busyTimes;
+        std::atomic<uint> _steals;
+
+        const std::function<void(uint)>* _job;
+        uint _generation;
+        uint _pending;
+        bool _stop;
+    };
+}
@@ -0,0 +1,17 @@
+#include "Transport.h"
+
+namespace SPH
+{
+    Transport::Bytes Transport::exchange(uint peer, const Bytes& out)
+    {
+        if (rank() < peer)
+        {
+            send(peer, out);
+            return receive(peer);
+        }
+
+        Bytes in = receive(peer);
+        send(peer, out);
+        return in;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Messages between the ranks of a distributed run, see DistributedRun.h.
+// A rank only talks to the others through this interface, so where they run
+// (threads of one process, processes of one machine) is the choice of the transport.
+
+#include <vector>
+
+#include "Globals.h"
+
+namespace SPH
+{
+    class Transport
+    {
+    public:
+        using Bytes = std::vector<char>;
+
+        virtual ~Transport() = default;
+
+        virtual uint rank() const = 0;
+        virtual uint size() const = 0;
+
+        // The messages between two ranks arrive in the order they were sent
+        virtual void send(uint to, const Bytes&) = 0;
+        // Waits for the next message of the rank
+        virtual Bytes receive(uint from) = 0;
+
+        // Sends to the peer and returns what it sent back. The lower rank sends first, so a rank
+        // going through its peers in increasing order never waits on one that waits on it,
+        // even when a send blocks until the other side reads.
+        Bytes exchange(uint peer, const Bytes&);
+    };
+}
@@ -1,7 +1,75 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "fluid_simulation/Benchmark.h"
+#include "fluid_simulation/DistributedRun.h"
 #include "fluid_simulation/GameSPH.h"
+#include "fluid_simulation/HeadlessRun.h"
+#include "fluid_simulation/PhysicsChecks.h"
 using namespace SPH;
 
-int main()
+int main(int argc, char** argv)
 {
+    // No window, see HeadlessRun.h for the options
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+    {
+        HeadlessOptions options;
+        if (!options.parse(argc, argv))
+        {
+            std::cout << "usage: --headless [--particles n [--settled] | --scene file] [--frames n] [--every n] [--output name]"
+                         " [--format png|qoi] [--view particles|cells]" << std::endl;
+            return 1;
+        }
+
+        return HeadlessRun(options).run();
+    }
+
+    // See Benchmark.h for the cases and the results
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        BenchmarkOptions options;
+        if (!options.parse(argc, argv))
+        {
+            std::cout << "usage: --bench [--particles n,...] [--threads n,...] [--configs name,...] [--steps n] [--output file]" << std::endl;
+            std::cout << "configs:";
+            for (const std::string& name : Benchmark::configNames())
+                std::cout << " " << name;
+            std::cout << std::endl;
+            return 1;
+        }
+
+        return Benchmark(options).run();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--compare") == 0)
+    {
+        bool threshold = argc == 6 && strcmp(argv[4], "--threshold") == 0;
+        if (argc != 4 && !threshold)
+        {
+            std::cout << "usage: --compare baseline.json current.json [--threshold percent]" << std::endl;
+            return 1;
+        }
+
+        return Benchmark::compare(argv[2], argv[3], threshold ? atof(argv[5]) : 10.0);
+    }
+
+    // See DistributedRun.h for the ranks and the transports
+    if (argc > 1 && strcmp(argv[1], "--ranks") == 0)
+    {
+        DistributedOptions options;
+        if (!options.parse(argc, argv))
+        {
+            std::cout << "usage: --ranks n [--transport sockets|threads] [--scene file] [--frames n] [--workers n] [--verify]" << std::endl;
+            return 1;
+        }
+
+        return DistributedRun(options).run();
+    }
+
+    // See PhysicsChecks.h for the scenes and the invariants
+    if (argc > 1 && strcmp(argv[1], "--check") == 0)
+        return PhysicsChecks().run();
+
     GameSPH{}.loop();
 }